@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "parse.h"
+#include "syntax.h"
+
+//bump when lowering or emission changes what is written for the same input
+#define CACHE_VERSION "cplus2 cache 1"
+
+//line directive in cached text
+typedef struct {
+	unsigned offset, len;
+	unsigned line; //relative to the item's first line, starting at 1, 0 for generated
+} cache_line_t;
+
+//emitted text of a top-level function, with the emitter state after it
+typedef struct {
+	item_t* item;
+	unsigned key[3]; //hashes of items (including macro expansions), source text and options
+
+	char* src; //source text of the item, compared on a hit
+	unsigned src_len;
+
+	char* text; //NULL until replayed or emitted
+	unsigned text_len;
+	vector_t lines; //cache_line_t
+
+	unsigned line, tok; //relative to the item's first line and token
+	int space, excess_newline, newline, gen;
+} cache_entry_t;
+
+//on-disk cache of top-level functions, hits are replayed by the emitter instead of being processed
+typedef struct {
+	char* dir; //NULL for none
+	vector_t entries; //cache_entry_t, in order of items
+} cache_t;
+
+typedef struct {
+	char version[sizeof(CACHE_VERSION)];
+	unsigned src_len, text_len, lines;
+	unsigned line, tok;
+	int space, excess_newline, newline, gen;
+} cache_header_t;
+
+//functions processed and emitted the same regardless of the rest of the file
+//conditional directives are switched by the emitter and macros can be redefined around them
+int cache_item_ok(parser_t* parser, item_t* item) {
+	if (item->ty!=item_func || !(item->contains & contains_defer)) return 0;
+	if (item->if_stack!=-1 || item->span.end<item->span.start) return 0;
+
+	token_t* start = vector_get(&parser->tokens, item->span.start);
+	token_t* end = vector_get(&parser->tokens, item->span.end);
+	return start->t==parser->source && end->t==parser->source;
+}
+
+char* cache_path(cache_t* cache, cache_entry_t* entry) {
+	return heapstr("%s/%08x%08x%08x", cache->dir, entry->key[0], entry->key[1], entry->key[2]);
+}
+
+int cache_read(FILE* f, void* x, unsigned len) {
+	return len==0 || fread(x, len, 1, f)==1;
+}
+
+//fills entry from its file if it has the same source, returns whether it did
+int cache_load(cache_t* cache, cache_entry_t* entry) {
+	char* path = cache_path(cache, entry);
+	FILE* f = fopen(path, "rb");
+	drop(path);
+
+	if (!f) return 0;
+
+	//the rest of the file has to be exactly what the header says, before anything is allocated for it
+	struct stat st;
+	cache_header_t header;
+	int hit = cache_read(f, &header, sizeof(cache_header_t))
+		&& memcmp(header.version, CACHE_VERSION, sizeof(CACHE_VERSION))==0
+		&& header.src_len==entry->src_len
+		&& fstat(fileno(f), &st)==0
+		&& (unsigned long long)st.st_size == sizeof(cache_header_t)+(unsigned long long)header.src_len
+			+header.text_len+(unsigned long long)header.lines*sizeof(cache_line_t);
+
+	if (hit) {
+		char* src = heap(header.src_len);
+		hit = cache_read(f, src, header.src_len) && memcmp(src, entry->src, entry->src_len)==0;
+		drop(src);
+	}
+
+	if (hit) {
+		entry->text = heap(header.text_len);
+		entry->text_len = header.text_len;
+
+		hit = cache_read(f, entry->text, header.text_len)
+			&& cache_read(f, vector_stock(&entry->lines, header.lines), sizeof(cache_line_t)*header.lines);
+
+		//directives are replayed in order, each within the text and after the last
+		unsigned from=0;
+		vector_iterator line_iter = vector_iterate(&entry->lines);
+		while (hit && vector_next(&line_iter)) {
+			cache_line_t* directive = line_iter.x;
+			hit = directive->offset>=from && directive->offset<=header.text_len
+				&& directive->len<=header.text_len-directive->offset;
+			from = directive->offset+directive->len;
+		}
+
+		if (!hit) {
+			drop(entry->text);
+			entry->text = NULL;
+			vector_clear(&entry->lines);
+		}
+	}
+
+	if (hit) {
+		entry->line = header.line;
+		entry->tok = header.tok;
+		entry->space = header.space;
+		entry->excess_newline = header.excess_newline;
+		entry->newline = header.newline;
+		entry->gen = header.gen;
+	}
+
+	fclose(f);
+	return hit;
+}
+
+//written elsewhere first, so concurrent builds never see part of an entry
+void cache_store(cache_t* cache, cache_entry_t* entry) {
+	char* path = cache_path(cache, entry);
+	char* tmp_path = heapstr("%s.%u", path, (unsigned)getpid());
+
+	FILE* f = fopen(tmp_path, "wb");
+	if (f) {
+		cache_header_t header = {.src_len=entry->src_len, .text_len=entry->text_len, .lines=entry->lines.length,
+				.line=entry->line, .tok=entry->tok, .space=entry->space,
+				.excess_newline=entry->excess_newline, .newline=entry->newline, .gen=entry->gen};
+		memcpy(header.version, CACHE_VERSION, sizeof(CACHE_VERSION));
+
+		int ok = fwrite(&header, sizeof(cache_header_t), 1, f)==1;
+		if (entry->src_len) ok = ok && fwrite(entry->src, entry->src_len, 1, f)==1;
+		if (entry->text_len) ok = ok && fwrite(entry->text, entry->text_len, 1, f)==1;
+		if (entry->lines.length) ok = ok && fwrite(entry->lines.data, sizeof(cache_line_t), entry->lines.length, f)==entry->lines.length;
+
+		if (fclose(f)==0 && ok) rename(tmp_path, path);
+		else remove(tmp_path);
+	}
+
+	drop(tmp_path);
+	drop(path);
+}
+
+//looks up every function that can be cached, hits are no longer processed
+//instrumentation and exit counters number sites across the file, so are never cached
+//neither is anything when reporting bloat, which needs every function lowered
+cache_t cache_new(char* dir, parser_t* parser, process_opts_t opts) {
+	cache_t cache = {.dir=dir, .entries=vector_new(sizeof(cache_entry_t))};
+	if (!dir || opts.instrument || opts.count_exits || opts.bloat) return cache;
+
+	if (mkdir(dir, 0777)!=0 && errno!=EEXIST) {
+		fprintf(stderr, "cant create cache directory %s\n", dir);
+		cache.dir=NULL;
+		return cache;
+	}
+
+	unsigned opts_hash = hash_bytes(2166136261u, CACHE_VERSION, sizeof(CACHE_VERSION));
+	opts_hash = hash_bytes(opts_hash, (char*)&opts.lower, sizeof(lower_ty));
+	opts_hash = hash_bytes(opts_hash, (char*)&opts.jump_cost, sizeof(unsigned));
+	opts_hash = hash_bytes(opts_hash, &opts.cold, sizeof(char));
+
+	vector_iterator item_iter = vector_iterate(&parser->items);
+	while (vector_next(&item_iter)) {
+		item_t* item = *(item_t**)item_iter.x;
+		if (!cache_item_ok(parser, item)) continue;
+
+		token_t* start = vector_get(&parser->tokens, item->span.start);
+		token_t* end = vector_get(&parser->tokens, item->span.end);
+
+		cache_entry_t* entry = vector_pushcpy(&cache.entries, &(cache_entry_t){.item=item,
+				.src=start->t+start->start, .src_len=end->start+end->len-start->start,
+				.text=NULL, .lines=vector_new(sizeof(cache_line_t))});
+
+		entry->key[0] = item->hash;
+		entry->key[1] = hash_bytes(2166136261u, entry->src, entry->src_len);
+		entry->key[2] = opts_hash;
+
+		if (cache_load(&cache, entry)) item->contains &= ~contains_defer;
+	}
+
+	return cache;
+}
+
+void cache_free(cache_t* cache) {
+	vector_iterator entry_iter = vector_iterate(&cache->entries);
+	while (vector_next(&entry_iter)) {
+		cache_entry_t* entry = entry_iter.x;
+		if (entry->text) drop(entry->text);
+		vector_free(&entry->lines);
+	}
+
+	vector_free(&cache->entries);
+}
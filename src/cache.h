@@ -0,0 +1,53 @@
+// Automatically generated header.
+
+#pragma once
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "parse.h"
+#include "syntax.h"
+#define CACHE_VERSION "cplus2 cache 1"
+
+//line directive in cached text
+typedef struct {
+	unsigned offset, len;
+	unsigned line; //relative to the item's first line, starting at 1, 0 for generated
+} cache_line_t;
+
+//emitted text of a top-level function, with the emitter state after it
+typedef struct {
+	item_t* item;
+	unsigned key[3]; //hashes of items (including macro expansions), source text and options
+
+	char* src; //source text of the item, compared on a hit
+	unsigned src_len;
+
+	char* text; //NULL until replayed or emitted
+	unsigned text_len;
+	vector_t lines; //cache_line_t
+
+	unsigned line, tok; //relative to the item's first line and token
+	int space, excess_newline, newline, gen;
+} cache_entry_t;
+
+//on-disk cache of top-level functions, hits are replayed by the emitter instead of being processed
+typedef struct {
+	char* dir; //NULL for none
+	vector_t entries; //cache_entry_t, in order of items
+} cache_t;
+
+typedef struct {
+	char version[sizeof(CACHE_VERSION)];
+	unsigned src_len, text_len, lines;
+	unsigned line, tok;
+	int space, excess_newline, newline, gen;
+} cache_header_t;
+
+int cache_item_ok(parser_t* parser, item_t* item);
+char* cache_path(cache_t* cache, cache_entry_t* entry);
+int cache_read(FILE* f, void* x, unsigned len);
+int cache_load(cache_t* cache, cache_entry_t* entry);
+void cache_store(cache_t* cache, cache_entry_t* entry);
+cache_t cache_new(char* dir, parser_t* parser, process_opts_t opts);
+void cache_free(cache_t* cache);
@@ -1,12 +1,38 @@
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
 #include "parse.h"
 #include "syntax.h"
+#include "cache.h"
+
+//output is appended to a buffer written out in blocks of this, or to a mapping of the file grown by it
+#define EMIT_BLOCK (1<<16)
+
+//items nested deeper are left out, above the parsers default --max-depth but bounded when it is 0
+#define EMIT_DEPTH (1<<14)
+
+//emitter state before a top-level item, where emit_patch resumes
+typedef struct {
+	unsigned off; //in output
+	unsigned line, tok, current_if;
+	int space, excess_newline, newline, gen, macro;
+} emit_mark_t;
 
 typedef struct {
 	parser_t* parser;
-	FILE* f;
+
+	int fd;
+	char* out; //pending output, or all of it when mapped
+	unsigned out_len, out_cap;
+	int mapped; //out maps fd, which is truncated to out_len when done
+	int failed; //writing or truncating fd did or items were nested too deep, the output is incomplete
+	unsigned depth; //of emit_item, which recurses for each level of items
+
 	char* fname;
+	unsigned fname_len;
 	unsigned line, tok;
 	int space, excess_newline, newline; //last character (excess) space/line, do not emit another
 	int gen; //last item gen
@@ -16,11 +42,161 @@ typedef struct {
 	//then our emitter will fuck-up due to its elegant design
 	int macro;
 	item_iterator_t iter;
+
+	cache_t* cache;
+	unsigned cache_i; //next entry, they are emitted in order
+	vector_t* capture; //cache_line_t of directives while an item is emitted for the cache, else NULL
+	unsigned capture_line; //first line of the captured item
+	unsigned capture_start; //offset in out, which is not written out while capturing
+
+	int keep; //output stays in out to be patched, never written
+	vector_t marks; //emit_mark_t before each top-level item and at the end, while kept
+	vector_t lines_out; //cache_line_t of every directive while kept, with lines of the source
+	unsigned items_len, tokens_len, lines; //of the parser the marks are for
 } emitter_t;
 
+//strlen of literals is folded
+#define emits(e, s) emitn(e, s, strlen(s))
+
 void emit_item(emitter_t* e);
+void emitn(emitter_t* e, char* s, unsigned len);
 int emit_item_next(emitter_t* e);
 
+//gives up for good on the first error, which is reported once
+void out_write_all(emitter_t* e, struct iovec* iov, int iovcnt) {
+	while (iovcnt>0 && !e->failed) {
+		ssize_t n = writev(e->fd, iov, iovcnt);
+		if (n<0) {
+			if (errno==EINTR) continue;
+			perror("write");
+			e->failed=1;
+			return;
+		}
+
+		while (iovcnt>0 && n>=iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt>0) {
+			iov->iov_base = (char*)iov->iov_base+n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+void out_flush(emitter_t* e) {
+	if (e->mapped || e->capture || e->keep || e->out_len==0) return;
+
+	out_write_all(e, &(struct iovec){.iov_base=e->out, .iov_len=e->out_len}, 1);
+	e->out_len=0;
+}
+
+//a mapping is grown by remapping the extended file, which keeps what was written
+//if that fails everything so far is copied out and written as usual from then on
+void out_reserve(emitter_t* e, unsigned len) {
+	if (e->out_len+len<=e->out_cap) return;
+
+	unsigned cap = e->out_cap*2 > e->out_len+len ? e->out_cap*2 : e->out_len+len+EMIT_BLOCK;
+
+	if (e->mapped) {
+		char* out = ftruncate(e->fd, cap)==0 ? mmap(NULL, cap, PROT_READ|PROT_WRITE, MAP_SHARED, e->fd, 0) : MAP_FAILED;
+		if (out!=MAP_FAILED) {
+			munmap(e->out, e->out_cap);
+			e->out = out;
+			e->out_cap = cap;
+			return;
+		}
+
+		out = heap(cap);
+		memcpy(out, e->out, e->out_len);
+		munmap(e->out, e->out_cap);
+		lseek(e->fd, 0, SEEK_SET);
+
+		e->out = out;
+		e->mapped = 0;
+	} else {
+		e->out = resize(e->out, cap);
+	}
+
+	e->out_cap = cap;
+}
+
+void out_write(emitter_t* e, char* s, unsigned len) {
+	//large writes go out along with what is pending instead of through it
+	if (len>=EMIT_BLOCK && !e->mapped && !e->capture && !e->keep) {
+		struct iovec iov[2] = {{.iov_base=e->out, .iov_len=e->out_len}, {.iov_base=s, .iov_len=len}};
+		out_write_all(e, iov, 2);
+		e->out_len=0;
+		return;
+	}
+
+	out_reserve(e, len);
+	memcpy(e->out+e->out_len, s, len);
+	e->out_len += len;
+
+	if (e->out_len>=EMIT_BLOCK) out_flush(e);
+}
+
+//#line without formatting, its own line
+void out_line(emitter_t* e, unsigned line) {
+	char num[16];
+	unsigned num_i = sizeof(num);
+	unsigned n = line;
+	do num[--num_i] = '0'+n%10; while (n/=10);
+
+	char* fname = line ? e->fname : "(generated)";
+	out_write(e, "#line ", 6);
+	out_write(e, num+num_i, sizeof(num)-num_i);
+	out_write(e, " \"", 2);
+	out_write(e, fname, line ? e->fname_len : strlen(fname));
+	out_write(e, "\"\n", 2);
+}
+
+void emit_init(emitter_t* e, int fd, int mapped, unsigned size) {
+	e->fd=fd;
+	e->out=NULL;
+	e->out_len=e->out_cap=0;
+	e->mapped=0;
+	e->failed=0;
+	e->depth=0;
+
+	if (mapped && ftruncate(fd, size)==0) {
+		char* out = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		if (out!=MAP_FAILED) {
+			e->out=out;
+			e->out_cap=size;
+			e->mapped=1;
+		}
+	}
+}
+
+//returns nonzero if the output couldnt be written in full
+int emit_finish(emitter_t* e) {
+	if (e->mapped) {
+		munmap(e->out, e->out_cap);
+		if (ftruncate(e->fd, e->out_len)!=0) {
+			perror("ftruncate");
+			e->failed=1;
+		}
+
+		return e->failed;
+	}
+
+	out_flush(e);
+	drop(e->out);
+
+	//a mapping given up on left the file longer
+	off_t end = lseek(e->fd, 0, SEEK_CUR);
+	if (end>0 && !e->failed && ftruncate(e->fd, end)!=0) {
+		perror("ftruncate");
+		e->failed=1;
+	}
+
+	return e->failed;
+}
+
 int emit_next_macro(emitter_t* e) {
 	if (!emit_item_next(e)) return 0;
 	emit_item(e);
@@ -50,16 +226,50 @@ int emit_item_ty(emitter_t* e, item_ty ty) {
 	}
 }
 
-#define LINE_SPEC e->newline ? "#line %u \"%s\"\n" : "\n#line %u \"%s\"\n"
+//continue output at line of the source (or of generated code, at 0)
+void emit_line(emitter_t* e, unsigned line) {
+	if (!e->newline) out_write(e, "\n", 1);
+
+	//captured directives are rewritten when replayed, for wherever the item is then
+	unsigned offset = e->out_len;
+	out_line(e, line);
+
+	if (e->capture) {
+		vector_pushcpy(e->capture, &(cache_line_t){.offset=offset-e->capture_start, .len=e->out_len-offset,
+				.line=line ? line-e->capture_line+1 : 0});
+	} else if (e->keep) {
+		vector_pushcpy(&e->lines_out, &(cache_line_t){.offset=offset, .len=e->out_len-offset, .line=line});
+	}
+
+	e->line=line;
+	e->newline=1;
+	e->excess_newline=0;
+}
 
 void flush_whitespace(emitter_t* e, unsigned tok_i) {
 	if (e->macro) return;
 
+	//nothing to pad from after generated items, continue on their line if it is the same
+	if (e->gen) {
+		unsigned line = parser_line(e->parser, tok_i);
+		if (line!=e->line || e->excess_newline) emit_line(e, line);
+		else if (!e->space) emits(e, " ");
+
+		e->tok=tok_i;
+		e->gen=0;
+		return;
+	}
+
 	token_t* etok = vector_get(&e->parser->tokens, e->tok);
 	token_t* start = vector_get(&e->parser->tokens, tok_i);
+
+	//out of a macro expansion, pad from the last token in the same text, or not at all
+	for (unsigned i=tok_i-1; etok->t!=start->t && i>e->tok; i--) etok = vector_get(&e->parser->tokens, i);
+	if (etok->t!=start->t) etok=start;
+
 	//pad output
 	int new_newline=0;
-	for (char* x = e->parser->t+etok->start; x<e->parser->t+start->start; x++) {
+	for (char* x = start->t+etok->start; x<start->t+start->start; x++) {
 		if (*x=='\n') {
 			new_newline++;
 			e->line++;
@@ -73,7 +283,7 @@ void flush_whitespace(emitter_t* e, unsigned tok_i) {
 			if (new_newline>=3) continue;
 
 			if (!e->excess_newline) {
-				fprintf(e->f, "\n");
+				out_write(e, "\n", 1);
 			} else {
 				e->excess_newline--;
 			}
@@ -83,35 +293,29 @@ void flush_whitespace(emitter_t* e, unsigned tok_i) {
 
 		if ((*x=='\t' || (!e->space && *x==' ')) && line_i==new_newline){
 			if (new_newline>=3) {
-				fprintf(e->f, LINE_SPEC, e->line, e->fname);
-				e->newline=1;
-				e->excess_newline=0;
+				emit_line(e, e->line);
 				new_newline=0;
 			}
 
-			fprintf(e->f, "%c", *x);
+			out_write(e, x, 1);
 		}
 	}
 
-	if (new_newline>=3) {
-		fprintf(e->f, LINE_SPEC, e->line, e->fname);
-		e->newline=1;
-		e->excess_newline=0;
-	}
+	if (new_newline>=3) emit_line(e, e->line);
 
 	e->space=0;
 	e->tok=tok_i;
 }
 
-void emits(emitter_t* e, char* s) {
-	if (e->macro) return;
+void emitn(emitter_t* e, char* s, unsigned len) {
+	if (e->macro || len==0) return;
 
 	if (s[0]=='\n' && (e->excess_newline || e->newline)) {
 		s++;
+		len--;
 		if (e->excess_newline) e->excess_newline--;
 	}
 
-	unsigned len = strlen(s);
 	if (len==0) return;
 
 	if (s[len-1]=='\n') e->excess_newline++;
@@ -122,41 +326,48 @@ void emits(emitter_t* e, char* s) {
 
 		if (*s=='(' && len==1) {
 			item_t* x = item_peek(&e->iter, 1);
-			if (x) flush_whitespace(e, x->span.start);
+			if (x && !x->gen) flush_whitespace(e, x->span.start);
 		}
 	}
 
-	fwrite(s, len, 1, e->f);
+	out_write(e, s, len);
 }
 
 void emit_align_item(emitter_t* e) {
-	if (e->iter.x->gen) {
-		if (!e->gen) {
-			fprintf(e->f, LINE_SPEC, 0, "(generated)");
-			e->tok=-1;
-			e->gen=1;
+	item_t* x = e->iter.x;
+
+	//attributed to what it was generated for, consecutive items of the same line share a directive
+	if (x->gen) {
+		unsigned line = x->gen_tok==-1 ? 0 : parser_line(e->parser, x->gen_tok);
+
+		if (line!=e->line || e->excess_newline) {
+			emit_line(e, line);
 		} else {
 			e->newline=0;
 			e->excess_newline=0;
 			e->space=0;
 		}
 
-		//discontinuity (by reinserting an item or after generated item)
-	} else if (e->tok>e->iter.x->span.start) {
-		token_t* start = vector_get(&e->parser->tokens, e->iter.x->span.start);
+		e->tok=-1;
+		e->gen=1;
 
-		e->line=1;
+		//deferred statement copied to an exit, marked and placed at its defer
+	} else if (item_defer_of(x)) {
+		item_t* defer = item_defer_of(x);
 
-		for (char* x=start->t+start->start; x>=start->t; x--) {
-			if (*x=='\n') e->line++;
-		}
+		if (!e->gen && e->tok>defer->span.start) emit_line(e, parser_line(e->parser, defer->span.start));
+		else flush_whitespace(e, defer->span.start);
+
+		emits(e, defer->ty==item_errdefer ? "/* errdefer */ " : "/* defer */ ");
+		e->tok=x->span.start;
 
-		fprintf(e->f, LINE_SPEC, e->line, e->fname);
-		e->newline=1;
-		e->excess_newline=0;
-		e->tok=e->iter.x->span.start;
+		//discontinuity (by reinserting an item)
+	} else if (!e->gen && e->tok>x->span.start) {
+		emit_line(e, parser_line(e->parser, x->span.start));
+		e->tok=x->span.start;
+		e->gen=0;
 	} else {
-		flush_whitespace(e, e->iter.x->span.end<e->iter.x->span.start ? e->iter.x->span.end : e->iter.x->span.start);
+		flush_whitespace(e, x->span.end<x->span.start ? x->span.end : x->span.start);
 	}
 }
 
@@ -175,7 +386,17 @@ void switch_branch(emitter_t* e, parser_if_t* p_if, unsigned from, unsigned to)
 	}
 }
 
+//state before top-level items, in order
+void emit_mark(emitter_t* e) {
+	unsigned item_i = e->iter.x_ref+1-(item_t**)e->parser->items.data;
+	if (item_i!=e->marks.length) return;
+
+	vector_pushcpy(&e->marks, &(emit_mark_t){.off=e->out_len, .line=e->line, .tok=e->tok, .current_if=e->parser->current_if,
+			.space=e->space, .excess_newline=e->excess_newline, .newline=e->newline, .gen=e->gen, .macro=e->macro});
+}
+
 int emit_item_next(emitter_t* e) {
+	if (e->keep && e->iter.stack.length==0 && !e->macro) emit_mark(e);
 	if (!item_next(&e->iter)) return 0;
 
 	if (e->macro) return 1;
@@ -212,7 +433,8 @@ int emit_item_next(emitter_t* e) {
 		p_if_i = e->parser->current_if;
 		for (;p_if_i!=common_parent;p_if_i=p_if->parent) {
 			p_if = vector_get(&e->parser->ifs, p_if_i);
-			fprintf(e->f, e->newline ? "#endif\n" : "\n#endif\n");
+			if (e->newline) out_write(e, "#endif\n", 7);
+			else out_write(e, "\n#endif\n", 8);
 			e->excess_newline+=e->newline ? 1 : 2;
 		}
 
@@ -248,21 +470,106 @@ void emit_sep_items(emitter_t* e, char* sep) {
 	}
 }
 
+//leaves the iterator at the macroeof if found, however deep
 int emit_search_for_macroeof(emitter_t* e) {
-	while (item_next(&e->iter)) {
-		if (e->iter.x->ty==item_macroeof) {
+	unsigned base = e->iter.stack.length;
+
+	while (1) {
+		if (!item_next(&e->iter)) {
+			if (e->iter.stack.length==base) return 0;
+			item_ascend(&e->iter);
+		} else if (e->iter.x->ty==item_macroeof) {
 			return 1;
 		} else if (e->iter.x->body.length>0) {
 			item_descend(&e->iter);
-			if (emit_search_for_macroeof(e)) return 1;
-			item_ascend(&e->iter);
 		}
 	}
+}
+
+//verbatim, like print_item
+void emit_text(emitter_t* e, item_t* item) {
+	if (item->gen) {
+		if (item->str) out_write(e, item->str, strlen(item->str));
+		return;
+	}
+
+	if (item->span.end<item->span.start) return;
 
-	return 0;
+	token_t* start = vector_get(&e->parser->tokens, item->span.start);
+	token_t* end = vector_get(&e->parser->tokens, item->span.end);
+	out_write(e, start->t+start->start, end->start+end->len-start->start);
+}
+
+//functions in the cache are replayed, or emitted as usual and stored
+//either way they start at a directive, so the text doesnt depend on what came before
+int emit_cache(emitter_t* e) {
+	cache_entry_t* entry = vector_get(&e->cache->entries, e->cache_i);
+	if (!entry || entry->item!=e->iter.x) return 0;
+
+	e->cache_i++;
+
+	item_t* x = e->iter.x;
+	unsigned line = parser_line(e->parser, x->span.start);
+
+	emit_line(e, line);
+	e->space=1;
+
+	if (entry->text) {
+		unsigned from=0;
+
+		vector_iterator line_iter = vector_iterate(&entry->lines);
+		while (vector_next(&line_iter)) {
+			cache_line_t* directive = line_iter.x;
+			out_write(e, entry->text+from, directive->offset-from);
+			out_line(e, directive->line ? line+directive->line-1 : 0);
+			from = directive->offset+directive->len;
+		}
+
+		out_write(e, entry->text+from, entry->text_len-from);
+	} else {
+		e->capture = &entry->lines;
+		e->capture_line = line;
+		e->capture_start = e->out_len;
+
+		emit_item(e);
+
+		e->capture = NULL;
+
+		entry->text_len = e->out_len-e->capture_start;
+		entry->text = heapcpy(entry->text_len, e->out+e->capture_start);
+
+		entry->line = e->line ? e->line-line+1 : 0;
+		entry->tok = e->gen ? -1 : e->tok-x->span.start;
+		entry->space = e->space;
+		entry->excess_newline = e->excess_newline;
+		entry->newline = e->newline;
+		entry->gen = e->gen;
+
+		cache_store(e->cache, entry);
+		out_flush(e);
+	}
+
+	e->line = entry->line ? line+entry->line-1 : 0;
+	e->tok = entry->gen ? -1 : x->span.start+entry->tok;
+	e->space = entry->space;
+	e->excess_newline = entry->excess_newline;
+	e->newline = entry->newline;
+	e->gen = entry->gen;
+
+	return 1;
 }
 
 void emit_item(emitter_t* e) {
+	if (e->cache && emit_cache(e)) return;
+
+	if (e->depth>=EMIT_DEPTH) {
+		if (!e->failed) fprintf(stderr, "items nested too deep to emit\n");
+		e->failed=1;
+		return;
+	}
+
+	e->depth++;
+
 	int descend=0;
 	switch (e->iter.x->ty) {
 		//directives, literals and names emitted verbatim
@@ -272,7 +579,7 @@ void emit_item(emitter_t* e) {
 		case item_elsedir:
 		case item_elifdir: {
 			emits(e, "\n");
-			if (!e->macro) print_item(e->parser, e->f, e->iter.x);
+			if (!e->macro) emit_text(e, e->iter.x);
 			emits(e, "\n");
 			break;
 		}
@@ -284,7 +591,16 @@ void emit_item(emitter_t* e) {
 		case item_op:
 		case item_macroarg:
 		case item_name: {
-			if (!e->macro) print_item(e->parser, e->f, e->iter.x);
+			//expanded from an object-like macro, whose call is in the body and spans another buffer than the expansion
+			item_t* call = e->iter.x->body.length>0 ? *(item_t**)vector_get(&e->iter.x->body, 0) : NULL;
+			if (call && call->ty==item_macrocall) {
+				item_descend(&e->iter);
+				while (emit_next(e));
+				item_ascend(&e->iter);
+			} else if (!e->macro) {
+				emit_text(e, e->iter.x);
+			}
+
 			e->newline=0;
 			break;
 		}
@@ -319,6 +635,11 @@ void emit_item(emitter_t* e) {
 			break;
 		}
 
+		case item_continue: {
+			emits(e, "continue;");
+			break;
+		}
+
 		//save time, these items descend
 		default: {
 			item_t* x = e->iter.x;
@@ -343,7 +664,7 @@ void emit_item(emitter_t* e) {
 
 					emit_item_next(e); //body
 
-					if (!e->macro) print_item(e->parser, e->f, e->iter.x);
+					if (!e->macro) emit_text(e, e->iter.x);
 
 					emits(e, "\n");
 					break;
@@ -378,7 +699,7 @@ void emit_item(emitter_t* e) {
 						if (e->iter.x->ty==item_expr) emits(e, ";");
 					}
 
-					flush_whitespace(e, x->span.end);
+					if (!x->gen) flush_whitespace(e, x->span.end);
 					emits(e, "}");
 					break;
 				}
@@ -387,7 +708,11 @@ void emit_item(emitter_t* e) {
 					emit_item_ty(e, item_typemod);
 					emits(e, e->iter.x->ty == item_struct ? "struct " : "union ");
 					emit_item_ty(e, item_name); //name
-					
+
+					//uses of the tag have no body
+					item_t* body = item_peek(&e->iter, 1);
+					if (!body || body->ty!=item_body) break;
+
 					emit_item_next(e);
 					item_descend(&e->iter); //body
 					
@@ -412,6 +737,9 @@ void emit_item(emitter_t* e) {
 					emits(e, "enum ");
 					emit_item_ty(e, item_name);
 
+					item_t* body = item_peek(&e->iter, 1);
+					if (!body || body->ty!=item_body) break;
+
 					emit_item_next(e);
 					item_descend(&e->iter);
 					emits(e, "{");
@@ -448,8 +776,18 @@ void emit_item(emitter_t* e) {
 				}
 				case item_varset: {
 					emit_next(e); //type
+					emit_next(e); //first name, its var only holds the initializer
 
 					emit_item_next(e);
+					item_descend(&e->iter);
+					if (item_peek(&e->iter, 1)) {
+						emits(e, " = ");
+						emit_next(e);
+					}
+
+					item_ascend(&e->iter);
+
+					if (item_peek(&e->iter, 1)) emits(e, ",");
 					emit_sep_items(e, ",");
 					emits(e, ";");
 					break;
@@ -527,6 +865,9 @@ void emit_item(emitter_t* e) {
 					emit_item(e);
 					if (e->iter.x->ty==item_expr) emits(e, ")");
 
+					//postfix members and indices
+					while (emit_item_ty(e, item_access) || emit_item_ty(e, item_dot) || emit_item_ty(e, item_array));
+
 					emit_next(e);
 					//rhs
 					if (e->iter.x->ty!=item_ternary) emit_next(e);
@@ -547,14 +888,17 @@ void emit_item(emitter_t* e) {
 					emit_next(e);
 				}
 
+				//the member is the item's own token
 				case item_dot: {
 					emits(e, ".");
-					emit_next(e);
+					if (!e->macro) emit_text(e, e->iter.x);
+					e->newline=0;
 					break;
 				}
 				case item_access: {
 					emits(e, "->");
-					emit_next(e);
+					if (!e->macro) emit_text(e, e->iter.x);
+					e->newline=0;
 					break;
 				}
 				case item_array: {
@@ -625,8 +969,12 @@ void emit_item(emitter_t* e) {
 				case item_for: {
 					emits(e, "for");
 					emits(e, "(");
+
+					//a var ends with its own ;
+					item_t* init = item_peek(&e->iter, 1);
 					emit_next(e); //var/expr
-					emits(e, ";");
+					if (!init || init->ty!=item_varset) emits(e, ";");
+
 					emit_next(e); //expr
 					emits(e, ";");
 					emit_next(e); //expr
@@ -648,15 +996,212 @@ void emit_item(emitter_t* e) {
 			e->macro=0;
 		item_ascend(&e->iter);
 	}
+
+	e->depth--;
 }
 
-void emit(char* fname, FILE* f, parser_t* parser) {
+emitter_t emitter_new(char* fname, parser_t* parser, cache_t* cache) {
 	parser->current_if = -1;
 
-	emitter_t e = {.iter=item_iterate(parser), .f=f, .parser=parser, .line=-1, .tok=-1, .gen=0, .space=1, .excess_newline=0, .newline=1};
+	emitter_t e = {.iter=item_iterate(parser), .parser=parser, .line=-1, .tok=-1, .gen=0, .space=1, .excess_newline=0, .newline=1,
+			.cache=cache, .cache_i=0, .capture=NULL, .keep=0};
 	e.fname = strreplace(fname, "\"", "\\\"");
+	e.fname_len = strlen(e.fname);
+
+	return e;
+}
+
+void emitter_free(emitter_t* e) {
+	if (e->keep) {
+		drop(e->out);
+		vector_free(&e->marks);
+		vector_free(&e->lines_out);
+	}
+
+	drop(e->fname);
+	item_iterator_free(&e->iter);
+}
+
+//mapped builds the output in a mapping of fd, presized from the source
+//returns nonzero if it couldnt be written
+int emit(char* fname, int fd, int mapped, parser_t* parser, cache_t* cache) {
+	emitter_t e = emitter_new(fname, parser, cache);
+
+	emit_init(&e, fd, mapped, parser->len*2+EMIT_BLOCK);
 	while (emit_next(&e));
+	int failed = emit_finish(&e);
+
+	emitter_free(&e);
+	return failed;
+}
+
+//emits everything into out, which emit_patch can then update after parser_edit
+void emit_kept(emitter_t* e) {
+	parser_t* parser = e->parser;
+
+	if (e->keep) {
+		vector_clear(&e->marks);
+		vector_clear(&e->lines_out);
+		vector_clear(&e->iter.stack);
+		item_restart(&e->iter);
+
+		parser->current_if = -1;
+		*e = (emitter_t){.iter=e->iter, .parser=parser, .fname=e->fname, .fname_len=e->fname_len,
+				.line=-1, .tok=-1, .gen=0, .space=1, .excess_newline=0, .newline=1,
+				.out=e->out, .out_cap=e->out_cap, .marks=e->marks, .lines_out=e->lines_out};
+	} else {
+		emit_init(e, -1, 0, parser->len*2+EMIT_BLOCK);
+		e->marks = vector_new(sizeof(emit_mark_t));
+		e->lines_out = vector_new(sizeof(cache_line_t));
+	}
+
+	e->keep = 1;
+	while (emit_next(e));
+
+	e->items_len = parser->items.length;
+	e->tokens_len = parser->tokens.length;
+	e->lines = parser_line(parser, parser->tokens.length-1);
+}
+
+//whether emitting from old continues exactly like new, once moved by the edit between
+//tokens after from_tok moved by tok_delta, lines after the edit by line_delta
+int emit_mark_eq(emit_mark_t* old, emit_mark_t* new, unsigned from_tok, int tok_delta, int line_delta) {
+	unsigned line = old->line==0 || old->line==-1 ? old->line : old->line+line_delta;
+	if (old->gen!=new->gen || line!=new->line || old->current_if!=new->current_if || old->macro!=new->macro
+		|| old->space!=new->space || old->excess_newline!=new->excess_newline || old->newline!=new->newline) return 0;
+
+	return old->gen || (from_tok==-1 || old->tok>from_tok ? old->tok+tok_delta : old->tok)==new->tok;
+}
+
+//replaces the output of top-level items parser_edit reparsed with that of the new ones in reparsed
+//output after them is kept, with its directives renumbered, if it would come out the same
+//otherwise everything is emitted again
+void emit_patch(emitter_t* e, span_t reparsed) {
+	parser_t* parser = e->parser;
+
+	//items, tokens and lines after the edit are the same, only moved
+	unsigned old_to = reparsed.end+e->items_len-parser->items.length;
+	int tok_delta = parser->tokens.length-e->tokens_len;
+	unsigned lines = parser_line(parser, parser->tokens.length-1);
+	int line_delta = lines-e->lines;
+
+	emit_mark_t* from_mark = vector_get(&e->marks, reparsed.start);
+	emit_mark_t* to_mark = vector_get(&e->marks, old_to);
+
+	if (e->marks.length!=e->items_len+1 || !from_mark || !to_mark
+		|| from_mark->current_if!=-1 || from_mark->macro || from_mark->gen) {
+		emit_kept(e);
+		return;
+	}
+
+	emit_mark_t from = *from_mark;
+
+	//set aside what comes after, then emit the new items in place of the old ones
+	unsigned tail_start = to_mark->off, tail_len = e->out_len-to_mark->off;
+	char* tail = heapcpy(tail_len, e->out+tail_start);
+
+	vector_t tail_marks = vector_new(sizeof(emit_mark_t));
+	vector_stockcpy(&tail_marks, e->marks.length-old_to, to_mark);
+	vector_truncate(&e->marks, reparsed.start);
+
+	unsigned lines_i = e->lines_out.length;
+	while (lines_i>0 && ((cache_line_t*)vector_get(&e->lines_out, lines_i-1))->offset>=from.off) lines_i--;
+
+	unsigned tail_lines_i = lines_i;
+	while (tail_lines_i<e->lines_out.length && ((cache_line_t*)vector_get(&e->lines_out, tail_lines_i))->offset<tail_start) tail_lines_i++;
+
+	vector_t tail_lines = vector_new(sizeof(cache_line_t));
+	if (tail_lines_i<e->lines_out.length)
+		vector_stockcpy(&tail_lines, e->lines_out.length-tail_lines_i, vector_get(&e->lines_out, tail_lines_i));
+	vector_truncate(&e->lines_out, lines_i);
+
+	e->out_len = from.off;
+	e->line = from.line;
+	e->tok = from.tok;
+	e->space = from.space;
+	e->excess_newline = from.excess_newline;
+	e->newline = from.newline;
+	e->gen = from.gen;
+	e->macro = from.macro;
+	parser->current_if = from.current_if;
+
+	vector_clear(&e->iter.stack);
+	e->iter.x_ref = (item_t**)parser->items.data+reparsed.start-1;
+	e->iter.end = reparsed.end;
+	while (emit_next(e));
+	e->iter.end = -1;
+
+	//nothing after the end of the file to continue the same
+	emit_mark_t* end = vector_get(&e->marks, reparsed.end);
+	int same = end && e->marks.length==reparsed.end+1
+		&& (old_to==e->items_len || emit_mark_eq(vector_get(&tail_marks, 0), end, from.tok, tok_delta, line_delta));
+
+	if (same && old_to==e->items_len) {
+		e->items_len = parser->items.length;
+		e->tokens_len = parser->tokens.length;
+		e->lines = lines;
+	} else if (same) {
+		vector_pop(&e->marks);
+
+		//marks are only ever between directives
+		unsigned tail_i = 0;
+		vector_iterator line_iter = vector_iterate(&tail_lines);
+		int more_lines = vector_next(&line_iter);
+
+		vector_iterator mark_iter = vector_iterate(&tail_marks);
+		while (vector_next(&mark_iter)) {
+			emit_mark_t* mark = mark_iter.x;
+
+			for (; more_lines && ((cache_line_t*)line_iter.x)->offset<mark->off; more_lines=vector_next(&line_iter)) {
+				cache_line_t* directive = line_iter.x;
+				out_write(e, tail+tail_i, directive->offset-tail_start-tail_i);
+
+				unsigned offset = e->out_len;
+				unsigned line = directive->line ? directive->line+line_delta : 0;
+				out_line(e, line);
+
+				vector_pushcpy(&e->lines_out, &(cache_line_t){.offset=offset, .len=e->out_len-offset, .line=line});
+				tail_i = directive->offset+directive->len-tail_start;
+			}
+
+			out_write(e, tail+tail_i, mark->off-tail_start-tail_i);
+			tail_i = mark->off-tail_start;
+
+			mark->off = e->out_len;
+			if (!mark->gen && (from.tok==-1 || mark->tok>from.tok)) mark->tok += tok_delta;
+			if (mark->line!=0 && mark->line!=-1) mark->line += line_delta;
+			vector_pushcpy(&e->marks, mark);
+		}
+
+		e->items_len = parser->items.length;
+		e->tokens_len = parser->tokens.length;
+		e->lines = lines;
+	}
+
+	drop(tail);
+	vector_free(&tail_marks);
+	vector_free(&tail_lines);
+
+	if (!same) emit_kept(e);
+}
+
+//writes kept output, returns nonzero if it couldnt
+int emit_write(emitter_t* e, int fd) {
+	e->fd = fd;
+	out_write_all(e, &(struct iovec){.iov_base=e->out, .iov_len=e->out_len}, 1);
+	return e->failed;
+}
+
+//used when the parser found nothing to lower, returns nonzero if it couldnt write
+int emit_passthrough(char* fname, int fd, parser_t* parser) {
+	emitter_t e = {.fd=fd};
+	e.fname = strreplace(fname, "\"", "\\\"");
+
+	char* line = heapstr("#line 1 \"%s\"\n", e.fname);
+	struct iovec iov[2] = {{.iov_base=line, .iov_len=strlen(line)}, {.iov_base=parser->source, .iov_len=parser->len}};
+	out_write_all(&e, iov, 2);
 
+	drop(line);
 	drop(e.fname);
-	item_iterator_free(&e.iter);
+	return e.failed;
 }
@@ -2,31 +2,75 @@
 
 #pragma once
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "parse.h"
 #include "syntax.h"
+#include "cache.h"
+#define EMIT_BLOCK (1<<16)
+typedef struct {
+	unsigned off; //in output
+	unsigned line, tok, current_if;
+	int space, excess_newline, newline, gen, macro;
+} emit_mark_t;
 typedef struct {
 	parser_t* parser;
-	FILE* f;
+	int fd;
+	char* out; //pending output, or all of it when mapped
+	unsigned out_len, out_cap;
+	int mapped; //out maps fd, which is truncated to out_len when done
+	int failed; //writing or truncating fd did or items were nested too deep, the output is incomplete
+	unsigned depth; //of emit_item, which recurses for each level of items
 	char* fname;
+	unsigned fname_len;
 	unsigned line, tok;
 	int space, excess_newline, newline; //last character (excess) space/line, do not emit another
 	int gen; //last item gen
-
 	//inside macro expansion; do not omit anything
 	//in the unfortunate case the end user decides not to align their macros to generated tokens (eg. delimiters)
 	//then our emitter will fuck-up due to its elegant design
 	int macro;
 	item_iterator_t iter;
+	cache_t* cache;
+	unsigned cache_i; //next entry, they are emitted in order
+	vector_t* capture; //cache_line_t of directives while an item is emitted for the cache, else NULL
+	unsigned capture_line; //first line of the captured item
+	unsigned capture_start; //offset in out, which is not written out while capturing
+	int keep; //output stays in out to be patched, never written
+	vector_t marks; //emit_mark_t before each top-level item and at the end, while kept
+	vector_t lines_out; //cache_line_t of every directive while kept, with lines of the source
+	unsigned items_len, tokens_len, lines; //of the parser the marks are for
 } emitter_t;
+#define emits(e, s) emitn(e, s, strlen(s))
+void out_write_all(emitter_t* e, struct iovec* iov, int iovcnt);
+void out_flush(emitter_t* e);
+void out_reserve(emitter_t* e, unsigned len);
+void out_write(emitter_t* e, char* s, unsigned len);
+void out_line(emitter_t* e, unsigned line);
+void emit_init(emitter_t* e, int fd, int mapped, unsigned size);
+int emit_finish(emitter_t* e);
 int emit_next_macro(emitter_t* e);
 int emit_next(emitter_t* e);
 int emit_item_ty(emitter_t* e, item_ty ty);
-#define LINE_SPEC e->newline ? "#line %u \"%s\"\n" : "\n#line %u \"%s\"\n"
+void emit_line(emitter_t* e, unsigned line);
 void flush_whitespace(emitter_t* e, unsigned tok_i);
-void emits(emitter_t* e, char* s);
+void emitn(emitter_t* e, char* s, unsigned len);
 void emit_align_item(emitter_t* e);
 void switch_branch(emitter_t* e, parser_if_t* p_if, unsigned from, unsigned to);
+void emit_mark(emitter_t* e);
 int emit_item_next(emitter_t* e);
 void emit_sep_items(emitter_t* e, char* sep);
 int emit_search_for_macroeof(emitter_t* e);
+void emit_text(emitter_t* e, item_t* item);
+int emit_cache(emitter_t* e);
 void emit_item(emitter_t* e);
-void emit(char* fname, FILE* f, parser_t* parser);
+emitter_t emitter_new(char* fname, parser_t* parser, cache_t* cache);
+void emitter_free(emitter_t* e);
+int emit(char* fname, int fd, int mapped, parser_t* parser, cache_t* cache);
+void emit_kept(emitter_t* e);
+int emit_mark_eq(emit_mark_t* old, emit_mark_t* new, unsigned from_tok, int tok_delta, int line_delta);
+void emit_patch(emitter_t* e, span_t reparsed);
+int emit_write(emitter_t* e, int fd);
+int emit_passthrough(char* fname, int fd, parser_t* parser);
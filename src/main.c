@@ -1,37 +1,191 @@
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "parse.h"
 #include "syntax.h"
 #include "emit.h"
+#include "cache.h"
+
+//returns whether any were fatal
+int print_errors(parser_t* p, unsigned from) {
+	int stop=0;
+	vector_iterator err_iter = vector_iterate(&p->errors);
+	err_iter.i=from-1;
+	while (vector_next(&err_iter)) {
+		parser_error_t* err = err_iter.x;
+		parser_printerr(p, err);
+		if (err->stop) stop=1;
+	}
+
+	return stop;
+}
+
+//offset,removed,inserted
+span_t edit_apply(parser_t* p, char* edit) {
+	unsigned offset=0, removed=0;
+	int inserted_i=0;
+	sscanf(edit, "%u,%u,%n", &offset, &removed, &inserted_i);
+
+	if (offset>p->len) offset=p->len;
+	if (removed>p->len-offset) removed=p->len-offset;
+
+	return parser_edit(p, offset, removed, inserted_i ? edit+inserted_i : "");
+}
 
 int main(int argc, char** argv) {
-	for (int i=1; i<argc; i++) {
-		if (argv[i][0]=='-') break;
-		parser_t p = parse_file(argv[i]);
-
-		int stop=0;
-		vector_iterator err_iter = vector_iterate(&p.errors);
-		while (vector_next(&err_iter)) {
-			parser_error_t* err = err_iter.x;
-			parser_printerr(&p, err);
-			if (err->stop) stop=1;
+	//files, then options
+	int files=1;
+	while (files<argc && argv[files][0]!='-') files++;
+
+	unsigned threads=1;
+	parser_limits_t limits = PARSER_LIMITS_DEFAULT;
+	process_opts_t opts = PROCESS_OPTS_DEFAULT;
+	char* cache_dir=NULL;
+	int mapped=0;
+	vector_t edits = vector_new(sizeof(char*)); //offset,removed,inserted applied after the first pass
+
+	for (int i=files; i<argc; i++) {
+		char* opt = argv[i];
+
+		if (strncmp(opt, "-j", 2)==0) {
+			//only declarations after the last directive, see parse_file_parallel
+			threads = opt[2] ? atoi(opt+2) : sysconf(_SC_NPROCESSORS_ONLN);
+			if (threads<1) threads=1;
+		} else if (strncmp(opt, "--max-depth=", 12)==0) {
+			limits.depth = atoi(opt+12);
+		} else if (strncmp(opt, "--max-tokens=", 13)==0) {
+			limits.tokens = atoi(opt+13);
+		} else if (strncmp(opt, "--max-backtracks=", 17)==0) {
+			limits.backtracks = atoi(opt+17);
+		} else if (strncmp(opt, "--max-expansions=", 17)==0) {
+			limits.expansions = atoi(opt+17);
+		} else if (strncmp(opt, "--max-time=", 11)==0) {
+			limits.time = atof(opt+11);
+		} else if (strcmp(opt, "--lower=auto")==0) {
+			opts.lower = lower_auto;
+		} else if (strcmp(opt, "--lower=dup")==0) {
+			opts.lower = lower_dup;
+		} else if (strcmp(opt, "--lower=ladder")==0) {
+			opts.lower = lower_ladder;
+		} else if (strcmp(opt, "--lower=cleanup")==0) {
+			opts.lower = lower_cleanup;
+		} else if (strncmp(opt, "--jump-cost=", 12)==0) {
+			opts.jump_cost = atoi(opt+12);
+		} else if (strcmp(opt, "--cold-exits")==0) {
+			opts.cold = 1;
+		} else if (strcmp(opt, "--count-exits")==0) {
+			opts.count_exits = 1;
+		} else if (strcmp(opt, "--instrument")==0) {
+			opts.instrument = "*";
+		} else if (strncmp(opt, "--instrument=", 13)==0) {
+			opts.instrument = opt+13;
+		} else if (strcmp(opt, "--bloat-report")==0) {
+			opts.bloat = bloat_table;
+		} else if (strcmp(opt, "--bloat-report=json")==0) {
+			opts.bloat = bloat_json;
+		} else if (strncmp(opt, "--edit=", 7)==0) {
+			vector_pushcpy(&edits, &(char*){opt+7});
+		} else if (strcmp(opt, "--mmap-output")==0) {
+			mapped = 1;
+		} else if (strcmp(opt, "--cache")==0) {
+			cache_dir = ".cplus2-cache";
+		} else if (strncmp(opt, "--cache=", 8)==0) {
+			cache_dir = opt+8;
+		} else {
+			fprintf(stderr, "unknown option %s\n", opt);
+			return 1;
+		}
+	}
+
+	opts.threads = threads;
+
+	//tables of instrumentation and counters and the cache cover the whole file
+	if (edits.length && (opts.instrument || opts.count_exits || opts.bloat || cache_dir)) {
+		fprintf(stderr, "--edit cant be combined with --instrument, --count-exits, --bloat-report or --cache\n");
+		return 1;
+	}
+
+	int failed=0;
+	for (int i=1; i<files; i++) {
+		parser_t p = threads>1 ? parse_file_parallel(argv[i], limits, threads) : parse_file(argv[i], limits);
+		if (p.passthrough && opts.instrument) parse_passthrough(&p);
+
+		//nothing emitted yet to patch
+		unsigned edit_i=0;
+		for (; p.passthrough && edit_i<edits.length; edit_i++) edit_apply(&p, *(char**)vector_get(&edits, edit_i));
+
+		if (p.passthrough) {
+			int out = open("./testout.c", O_WRONLY|O_CREAT|O_TRUNC, 0644);
+			if (emit_passthrough(argv[i], out, &p)) failed=1;
+			close(out);
+
+			parser_free(&p);
+			continue;
 		}
 
-		if (stop) return 0;
+		//every file is checked so all errors come out in one run
+		if (print_errors(&p, 0)) {
+			failed=1;
+			parser_free(&p);
+			continue;
+		}
 
 		print_item_tree(&p);
 
-		process_t proc = process_new(&p);
+		unsigned errors_i = p.errors.length;
+		cache_t cache = cache_new(cache_dir, &p, opts);
+		process_t proc = process_new(&p, opts);
 
 		print_item_tree(&p);
+		if (opts.bloat && !p.stop) bloat_report(&proc, stderr);
+
+		if (print_errors(&p, errors_i)) {
+			failed=1;
+			process_free(&proc);
+			cache_free(&cache);
+			parser_free(&p);
+			continue;
+		}
+
+		if (edit_i<edits.length) {
+			emitter_t e = emitter_new("test.c", &p, NULL);
+			emit_kept(&e);
+
+			//only what was reparsed is processed and emitted again
+			for (; edit_i<edits.length && !p.stop; edit_i++) {
+				span_t reparsed = edit_apply(&p, *(char**)vector_get(&edits, edit_i));
+				process_items(&proc, reparsed.start, reparsed.end);
+				if (!p.stop) emit_patch(&e, reparsed);
+			}
+
+			if (p.stop) {
+				print_errors(&p, 0);
+				failed=1;
+			} else {
+				int out = open("./testout.c", O_WRONLY|O_CREAT|O_TRUNC, 0644);
+				if (emit_write(&e, out)) failed=1;
+				close(out);
+			}
+
+			emitter_free(&e);
+			process_free(&proc);
+			cache_free(&cache);
+			parser_free(&p);
+			continue;
+		}
 
 		process_free(&proc);
 
-		FILE* out = fopen("./testout.c", "w");
-		emit("test.c", out, &p);
+		//mapping needs the file open for reading as well
+		int out = open("./testout.c", O_RDWR|O_CREAT|O_TRUNC, 0644);
+		if (emit("test.c", out, mapped, &p, &cache)) failed=1;
+		close(out);
 
+		cache_free(&cache);
 		parser_free(&p);
 	}
 
-	return 0;
+	vector_free(&edits);
+	return failed;
 }
@@ -2,4 +2,12 @@
 
 #pragma once
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "parse.h"
+#include "syntax.h"
+#include "emit.h"
+#include "cache.h"
+int print_errors(parser_t* p, unsigned from);
+span_t edit_apply(parser_t* p, char* edit);
 int main(int argc, char** argv);
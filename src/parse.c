@@ -1,5 +1,8 @@
 #include <stdio.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include "util.h"
 #include "vector.h"
@@ -12,10 +15,33 @@ span_t parser_current(parser_t* parser) {
 }
 
 void parser_error(parser_t* parser, span_t span, char* err, int stop) {
+	//unwinding after a limit, dont bother
+	if (parser->exhausted) return;
+
 	vector_pushcpy(&parser->errors, &(parser_error_t){.span=span, .err=err, .stop=stop});
 	if (stop) parser->stop=1;
 }
 
+double parser_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+//reports the limit once, after which the parser only sees eof so it unwinds quickly
+void parser_exhaust(parser_t* parser, char* limit) {
+	if (parser->exhausted) return;
+
+	parser_error(parser, parser_current(parser), heapstr("%s limit exceeded, giving up", limit), 1);
+	parser->exhausted=1;
+}
+
+//checked periodically since it isnt free
+void parser_check_time(parser_t* parser) {
+	if (parser->limits.time>0 && parser_time()-parser->start_time>parser->limits.time)
+		parser_exhaust(parser, "time");
+}
+
 void parser_printerr(parser_t* parser, parser_error_t* perr) {
 	int line=1,col=1;
 	token_t* start_tok = vector_get(&parser->tokens, perr->span.start);
@@ -42,30 +68,83 @@ void print_item(parser_t* parser, FILE* f, item_t* item) {
 	fprintf(f, "%.*s", end->start+end->len-start->start, start->t+start->start);
 }
 
+//spans across macro expansions join their tokens, since they arent in one text
+//the eof an exhausted parser hands out isnt stored, spans ending in it stop before
 char* item_str(parser_t* parser, item_t* item) {
+	unsigned end_i = item->span.end<parser->tokens.length ? item->span.end : parser->tokens.length-1;
 	token_t* start = vector_get(&parser->tokens, item->span.start);
-	token_t* end = vector_get(&parser->tokens, item->span.end);
+	token_t* end = vector_get(&parser->tokens, end_i);
+
+	if (end_i<item->span.start || end_i==-1) return heapcpy(1, &(char){0});
+	if (start->t==end->t) return heapcpysubstr(start->t+start->start, end->start+end->len-start->start);
 
-	if (item->span.end<item->span.start) return heapcpy(1, &(char){0});
-	return heapcpysubstr(start->t+start->start, end->start+end->len-start->start);
+	vector_t s = vector_new(1);
+	for (unsigned i=item->span.start; i<=end_i; i++) {
+		token_t* tok = vector_get(&parser->tokens, i);
+		if (tok->len) vector_stockcpy(&s, tok->len, tok->t+tok->start);
+	}
+
+	vector_pushcpy(&s, &(char){0});
+	return (char*)s.data;
 }
 
-void print_item_tree_rec(parser_t* parser, vector_t* items, int depth) {
-	vector_iterator item_iter = vector_iterate(items);
-	while (vector_next(&item_iter)) {
-		item_t* item = *(item_t**)item_iter.x;
-		for (int i=0; i<depth; i++) printf("  ");
+//line of the token at tok_i in its source
+//not thread safe, line_starts is built on first use
+unsigned parser_line(parser_t* parser, unsigned tok_i) {
+	token_t* tok = vector_get(&parser->tokens, tok_i);
+
+	//macro expansions are in their own text
+	if (tok->t!=parser->source) {
+		unsigned line=1;
+		for (char* x=tok->t; x<tok->t+tok->start; x++) {
+			if (*x=='\n') line++;
+		}
+
+		return line;
+	}
+
+	if (parser->line_starts.length==0) {
+		vector_pushcpy(&parser->line_starts, &(unsigned){0});
+		for (unsigned i=0; i<parser->len; i++) {
+			if (parser->source[i]=='\n') vector_pushcpy(&parser->line_starts, &(unsigned){i+1});
+		}
+	}
+
+	//last line starting at or before the token
+	unsigned lo=0, hi=parser->line_starts.length;
+	while (hi-lo>1) {
+		unsigned mid = (lo+hi)/2;
+		if (*(unsigned*)vector_get(&parser->line_starts, mid)<=tok->start) lo=mid;
+		else hi=mid;
+	}
+
+	return lo+1;
+}
+
+void print_item_tree(parser_t* parser) {
+	vector_t stack = vector_new(sizeof(vector_iterator));
+	vector_iterator top_iter = vector_iterate(&parser->items);
+	vector_pushcpy(&stack, &top_iter);
+
+	while (stack.length>0) {
+		vector_iterator* item_iter = vector_get(&stack, stack.length-1);
+		if (!vector_next(item_iter)) {
+			vector_pop(&stack);
+			continue;
+		}
+
+		item_t* item = *(item_t**)item_iter->x;
+		for (int i=1; i<stack.length; i++) printf("  ");
 
 		printf("%s (", ITEM_NAMES[item->ty]);
 		print_item(parser, stdout, item);
 		printf(")\n");
 
-		print_item_tree_rec(parser, &item->body, depth+1);
+		vector_iterator body_iter = vector_iterate(&item->body);
+		vector_pushcpy(&stack, &body_iter);
 	}
-}
 
-void print_item_tree(parser_t* parser) {
-	print_item_tree_rec(parser, &parser->items, 0);
+	vector_free(&stack);
 }
 
 int parser_ncmp(parser_t* parser, char* x) {
@@ -138,7 +217,7 @@ token_t parser_skip_arg(parser_t* parser) {
 	tok.strstart=parser->i;
 
 	unsigned parens=0;
-	while ((parser->t[parser->i]!=')' && parser->t[parser->i]!=',') || parens!=0) {
+	while (parser->t[parser->i] && ((parser->t[parser->i]!=')' && parser->t[parser->i]!=',') || parens!=0)) {
 		if (parser->t[parser->i]=='(') parens++;
 		else if (parser->t[parser->i]==')') parens--;
 
@@ -166,7 +245,9 @@ void parse_string(parser_t* parser, token_t* tok) {
 	}
 
 	tok->strlen=parser->i-tok->strstart;
-	parser->i++;
+	//dont step over the terminator, recovery keeps lexing after this
+	if (parser->t[parser->i]) parser->i++;
+	else parser_error(parser, parser_current(parser), "string unterminated", 1);
 }
 
 int parse_num(parser_t* parser, token_t* tok) {
@@ -215,16 +296,16 @@ token_t parse_token_fallacious(parser_t* parser) {
 
 			tok.strstart=parser->i;
 
-			if (parser->t[parser->i]=='\\') parser->i++;
-			parser->i++;
+			if (parser->t[parser->i]=='\\' && parser->t[parser->i+1]) parser->i++;
+			if (parser->t[parser->i]) parser->i++;
 
 			tok.strlen=parser->i-tok.strstart;
 
 			if (parser->t[parser->i]!='\'') {
 				parser_error(parser, parser_current(parser), "character string unterminated", 1);
+			} else {
+				parser->i++;
 			}
-
-			parser->i++;
 			tok.ty=tok_char;
 			break;
 		}
@@ -355,6 +436,7 @@ token_t parse_token_fallacious(parser_t* parser) {
 				else break;
 			}
 			else if (parser_ncmp(parser, "defer")) tok.ty=tok_defer;
+			else if (parser_ncmp(parser, "errdefer")) tok.ty=tok_errdefer;
 			else if (parser_ncmp(parser, "return")) tok.ty=tok_return;
 			else if (parser_ncmp(parser, "do")) tok.ty=tok_do;
 			else if (parser_ncmp(parser, "while")) tok.ty=tok_while;
@@ -362,6 +444,7 @@ token_t parse_token_fallacious(parser_t* parser) {
 			else if (parser_ncmp(parser, "goto")) tok.ty=tok_goto;
 			else if (parser_ncmp(parser, "switch")) tok.ty=tok_switch;
 			else if (parser_ncmp(parser, "break")) tok.ty=tok_break;
+			else if (parser_ncmp(parser, "continue")) tok.ty=tok_continue;
 			else if (parser_ncmp(parser, "case")) tok.ty=tok_case;
 			else if (parser_ncmp(parser, "default")) tok.ty=tok_default;
 			else if (parser_ncmp(parser, "typedef")) tok.ty=tok_typedef;
@@ -389,9 +472,21 @@ token_t parse_token_fallacious(parser_t* parser) {
 
 token_t parse_token(parser_t* parser) {
 	token_t t;
-	if (parser->tok_i<parser->tokens.length) {
+	if (parser->exhausted) {
+		parser->tok_i++;
+		return (token_t){.ty=tok_eof, .t=parser->t, .start=parser->i};
+	} else if (parser->tok_i<parser->tokens.length) {
 		t = *(token_t*)vector_get(&parser->tokens, parser->tok_i++);
 	} else {
+		if (parser->limits.tokens) {
+			unsigned tokens = parser->shared ? atomic_fetch_add(&parser->shared->tokens, 1) : parser->tokens.length;
+			if (tokens>=parser->limits.tokens) parser_exhaust(parser, "token");
+		}
+
+		if (parser->tokens.length%1024==0) parser_check_time(parser);
+
+		if (parser->exhausted) return parse_token(parser);
+
 		t = parse_token_fallacious(parser);
 		t.len=parser->i-t.start;
 		vector_pushcpy(&parser->tokens, &t);
@@ -446,12 +541,19 @@ parser_save_t parser_save(parser_t* parser) {
 }
 
 void parser_start(parser_t* parser) {
+	//every nested construct holds a save, so this bounds recursion
+	if (parser->limits.depth && parser->stack.vec.length>=parser->limits.depth)
+		parser_exhaust(parser, "nesting depth");
+
 	vector_pushcpy(&parser->stack.vec, (parser_save_t[]){parser_save(parser)});
 }
 
 int parser_expectstart(parser_t* parser, token_ty ty) {
 	if (parser_expect(parser, ty, 0)) {
-		vector_pushcpy(&parser->stack.vec, &(parser_save_t){.tok_i=parser->tok_i-1, .item_i=parser->items.length, .item_pool_i=parser->item_pool.length});
+		//recovery may cancel this, so it needs the macro state too
+		parser_save_t save = parser_save(parser);
+		save.tok_i--;
+		vector_pushcpy(&parser->stack.vec, &save);
 		return 1;
 	} else {
 		return 0;
@@ -486,6 +588,14 @@ void parser_macro_pop(parser_t* parser, unsigned len) {
 }
 
 void parser_restore(parser_t* parser, parser_save_t* save) {
+	parser->backtracks++;
+	if (parser->limits.backtracks) {
+		unsigned backtracks = parser->shared ? atomic_fetch_add(&parser->shared->backtracks, 1)+1 : parser->backtracks;
+		if (backtracks>=parser->limits.backtracks) parser_exhaust(parser, "backtrack");
+	}
+
+	if (parser->backtracks%1024==0) parser_check_time(parser);
+
 	parser->tok_i=save->tok_i;
 	parser_trunc_items(parser, save->item_pool_i);
 	vector_truncate(&parser->items, save->item_i);
@@ -517,6 +627,48 @@ void parser_finish(parser_t* parser) {
 	vector_pop(&parser->stack.vec);
 }
 
+//fnv-1a, continuing from h
+unsigned hash_bytes(unsigned h, char* x, unsigned len) {
+	for (unsigned i=0; i<len; i++) {
+		h ^= (unsigned char)x[i];
+		h *= 16777619;
+	}
+
+	return h;
+}
+
+//bottom-up, so children are already hashed
+//leaves hash their text like item_str, so items that item_eq has equal hash the same
+unsigned item_hash(parser_t* parser, item_t* item) {
+	unsigned h = hash_bytes(2166136261u, (char*)&item->ty, sizeof(item_ty));
+
+	if (item->body.length==0) {
+		//like item_str, up to the last stored token
+		unsigned end_i = item->span.end<parser->tokens.length ? item->span.end : parser->tokens.length-1;
+		if (end_i<item->span.start || end_i==-1) return h;
+
+		token_t* start = vector_get(&parser->tokens, item->span.start);
+		token_t* end = vector_get(&parser->tokens, end_i);
+		if (start->t==end->t) return hash_bytes(h, start->t+start->start, end->start+end->len-start->start);
+
+		//across macro expansions, token by token
+		for (unsigned i=item->span.start; i<=end_i; i++) {
+			token_t* tok = vector_get(&parser->tokens, i);
+			h = hash_bytes(h, tok->t+tok->start, tok->len);
+		}
+
+		return h;
+	}
+
+	vector_iterator body_iter = vector_iterate(&item->body);
+	while (vector_next(&body_iter)) {
+		item_t* child = *(item_t**)body_iter.x;
+		h = hash_bytes(h, (char*)&child->hash, sizeof(unsigned));
+	}
+
+	return h;
+}
+
 item_t* parser_wrap(parser_t* parser, item_ty ty, int oob) {
 	parser_save_t* save = vector_get(&parser->stack.vec, parser->stack.vec.length-1);
 	//make new save, i guess? happens during syntax errors
@@ -532,12 +684,22 @@ item_t* parser_wrap(parser_t* parser, item_ty ty, int oob) {
 	if (parser->items.length>save->item_i)
 		vector_stockcpy(&item->body, parser->items.length-save->item_i, vector_get(&parser->items, save->item_i));
 
+	switch (ty) {
+		case item_defer: case item_errdefer: item->contains = contains_defer; break;
+		case item_ret: case item_break: case item_continue: case item_goto: item->contains = contains_exit; break;
+		case item_label: item->contains = contains_label; break;
+		default:;
+	}
+
 	vector_iterator body_iter = vector_iterate(&item->body);
 	while (vector_next(&body_iter)) {
 		item_t* child = *(item_t**)body_iter.x;
 		child->parent = item;
+		item->contains |= child->contains;
 	}
 
+	item->hash = item_hash(parser, item);
+
 	vector_truncate(&parser->items, save->item_i);
 	if (!oob) vector_pushcpy(&parser->items, &item);
 	vector_pushcpy(&parser->item_pool, &item);
@@ -618,6 +780,33 @@ int parser_parse_if(parser_t* parser) {
 
 int parser_expect_pp(parser_t* parser, token_ty ty, int err);
 
+void parser_define(parser_t* parser, item_t* define) {
+	macro_t* macro = define->macro;
+
+	item_t* name_item = *(item_t**)vector_get(&define->body, 0);
+	token_t* name_tok = vector_get(&parser->tokens, name_item->span.start);
+	macro->name = (map_sized_t){.bin=name_tok->t+name_tok->start, .size=name_tok->len};
+
+	vector_clear(&macro->arg_names);
+	vector_iterator arg_iter = vector_iterate(&macro->args);
+	while (vector_next(&arg_iter)) {
+		item_t* arg = *(item_t**)arg_iter.x;
+		token_t* arg_tok = vector_get(&parser->tokens, arg->span.start);
+		vector_pushcpy(&macro->arg_names, &(map_sized_t){.bin=arg_tok->t+arg_tok->start, .size=arg_tok->len});
+	}
+
+	map_insertcpy(&parser->macros, &macro->name, &define);
+}
+
+//makes macros defined by another parser's top-level items visible
+void parser_import_macros(parser_t* parser, parser_t* from) {
+	vector_iterator item_iter = vector_iterate(&from->items);
+	while (vector_next(&item_iter)) {
+		item_t* item = *(item_t**)item_iter.x;
+		if (item->ty==item_define) map_insertcpy(&parser->macros, &item->macro->name, &item);
+	}
+}
+
 void parser_handle_macros(parser_t* parser) {
 	token_t t = parse_token(parser);
 	parser->tok_i--;
@@ -639,6 +828,11 @@ void parser_handle_macros(parser_t* parser) {
 	item_t** macro_item = map_find(&parser->macros, &(map_sized_t){.bin=t.t+t.start, .size=t.len});
 	if (!macro_item) return;
 
+	if (parser->limits.expansions && parser->expansion_stack.length>=parser->limits.expansions) {
+		parser_exhaust(parser, "macro expansion depth");
+		return;
+	}
+
 	parser_start(parser);
 	parser_expect(parser, tok_name, 1);
 	parser_wrap(parser, item_name, 0);
@@ -654,17 +848,15 @@ void parser_handle_macros(parser_t* parser) {
 			parser_start(parser);
 			parser_expect(parser, tok_lparen, 1);
 
-			vector_iterator arg_iter = vector_iterate(&macro->args);
+			vector_iterator arg_iter = vector_iterate(&macro->arg_names);
 			while (vector_next(&arg_iter)) {
-				item_t* arg_name_item = *(item_t**)arg_iter.x;
-				token_t* arg_name_tok = vector_get(&parser->tokens, arg_name_item->span.start);
-
 				parser_start(parser);
 				parser_skip_arg(parser);
 				item_t* arg = parser_push(parser, item_macroarg, 0);
 
 				arg->arg = heapcpy(sizeof(arg_t), &(arg_t){.arg_str=item_str(parser, arg)});
-				map_insertcpy(&parser->macros, &(map_sized_t){.bin=arg_name_tok->t+arg_name_tok->start, .size=arg_name_tok->len}, &arg);
+				vector_pushcpy(&parser->arg_strs, &arg->arg->arg_str);
+				map_insertcpy(&parser->macros, arg_iter.x, &arg);
 
 				if (arg_iter.i==macro->args.length-1) parser_expect(parser, tok_rparen, 1);
 				else parser_expect(parser, tok_comma, 1);
@@ -710,10 +902,11 @@ void parser_handle_pp(parser_t* parser) {
 		} else if (parser_expectstart(parser, tok_define)) {
 			parser_start(parser);
 			parser_expect(parser, tok_name, 1);
-			item_t* name_item = parser_push(parser, item_name, 0);
+			parser_push(parser, item_name, 0);
 
 			macro_t* macro = heap(sizeof(macro_t));
 			macro->args = vector_new(sizeof(item_t*));
+			macro->arg_names = vector_new(sizeof(map_sized_t));
 
 			parser_start(parser);
 			if (parser_expect(parser, tok_lparen, 0)) {
@@ -741,10 +934,7 @@ void parser_handle_pp(parser_t* parser) {
 			vector_pushcpy(&parser->items, &define);
 
 			define->macro = macro;
-
-			token_t* name_tok = vector_get(&parser->tokens, name_item->span.start);
-			map_insertcpy(&parser->macros,
-								 &(map_sized_t){.bin=name_tok->t+name_tok->start, .size=name_tok->len}, &define);
+			parser_define(parser, define);
 		} else if (parser_parse_if(parser)) {
 			continue;
 		} else if (parser_expectstart(parser, tok_dir)) {
@@ -895,6 +1085,11 @@ int parse_initializer(parser_t* parser) {
 	}
 
 	if (!parser_expect_pp(parser, tok_rbrace, 0)) while (1) {
+		if (parser_peek_pp(parser, tok_eof, 1)) {
+			parser_error(parser, parser_current(parser), "unterminated initializer", 1);
+			break;
+		}
+
 		parser_start(parser);
 		if (parser_expect_pp(parser, tok_dot, 0)) {
 			parser_start(parser);
@@ -986,8 +1181,8 @@ int parse_expr_left(parser_t* parser, int optional) {
 
 		if (parser_expect_pp(parser, tok_lparen, 0)) {
 			parse_args(parser);
-			parse_addendums(parser);
 			parser_wrap(parser, item_fncall, 0);
+			parse_addendums(parser);
 		}
 
 	} else if (parser_expect_pp(parser, tok_num, 0)) {
@@ -996,12 +1191,12 @@ int parse_expr_left(parser_t* parser, int optional) {
 		parser_wrap(parser, item_literal_str, 0);
 	} else if (parser_expect_pp(parser, tok_char, 0)) {
 		parser_wrap(parser, item_literal_char, 0);
-	} else {
+	} else if (optional && !cast) {
 		parser_finish(parser);
-		if (cast) parser_finish(parser);
-
-		if (optional && !cast) return 0;
-		else parser_error(parser, parser_current(parser), "expected expression", 1);
+		return 0;
+	} else {
+		//keep the save for the caller, like an empty expression, so recovery can rewind
+		parser_error(parser, parser_current(parser), "expected expression", 1);
 	}
 
 	if (cast) {
@@ -1067,10 +1262,13 @@ int parse_ty(parser_t* parser, int named)	{
 		if (parser_expectstart_pp(parser, tok_name))
 			parser_push(parser, item_name, 0);
 
-		parser_start(parser);
-
-		if (parser_expect_pp(parser, tok_lbrace, 0)) {
+		if (parser_expectstart_pp(parser, tok_lbrace)) {
 			if (!parser_expect_pp(parser, tok_rbrace, 0)) while (1) {
+				if (parser_peek_pp(parser, tok_eof, 1)) {
+					parser_error(parser, parser_current(parser), "unterminated body", 1);
+					break;
+				}
+
 				if (is_enum) {
 					parser_start(parser);
 					parser_expect_pp(parser, tok_name, 1);
@@ -1174,6 +1372,9 @@ void parse_stmt(parser_t* parser) {
 	if (parser_expect_pp(parser, tok_break, 0)) {
 		parser_expect_pp(parser, tok_end, 1);
 		parser_push(parser, item_break, 0);
+	} else if (parser_expect_pp(parser, tok_continue, 0)) {
+		parser_expect_pp(parser, tok_end, 1);
+		parser_push(parser, item_continue, 0);
 	} else if (parser_expect_pp(parser, tok_goto, 0)) {
 		parser_start(parser);
 		parser_expect_pp(parser, tok_name, 1);
@@ -1185,10 +1386,17 @@ void parse_stmt(parser_t* parser) {
 		parse_expr(parser, 1, 0);
 		parser_expect_pp(parser, tok_end, 1);
 		parser_push(parser, item_defer, 0);
+	} else if (parser_expect_pp(parser, tok_errdefer, 0)) {
+		parse_expr(parser, 1, 0);
+		parser_expect_pp(parser, tok_end, 1);
+		parser_push(parser, item_errdefer, 0);
 	} else if (parser_expect_pp(parser, tok_return, 0)) {
+		//return errdefer x; and return defer x; tell errdefers what the exit is
+		char mark = parser_expect_pp(parser, tok_errdefer, 0) ? 1 : parser_expect_pp(parser, tok_defer, 0) ? -1 : 0;
+
 		parse_expr(parser, 1, 1);
 		parser_expect_pp(parser, tok_end, 1);
-		parser_push(parser, item_ret, 0);
+		parser_push(parser, item_ret, 0)->mark = mark;
 	}  else if (parser_expect_pp(parser, tok_do, 0)) {
 		parse_stmt(parser);
 		parser_expect_pp(parser, tok_while, 1);
@@ -1261,7 +1469,10 @@ void parse_stmt(parser_t* parser) {
 
 		if (!parser_expect_pp(parser, tok_rbrace, 0))
 			while (1) {
-				if (parser_expectstart_pp(parser, tok_case)) {
+				if (parser_peek_pp(parser, tok_eof, 1)) {
+					parser_error(parser, parser_current(parser), "unterminated switch", 1);
+					break;
+				} else if (parser_expectstart_pp(parser, tok_case)) {
 					parse_expr(parser, 1, 0);
 
 					if (parser_expectstart_pp(parser, tok_ellipsis)){
@@ -1304,14 +1515,89 @@ void parse_stmt(parser_t* parser) {
 	}
 }
 
+//panic mode, skips to the next ; or balanced }
+//a } closing the enclosing block is left alone unless top
+void parser_skip_stmt(parser_t* parser, int top) {
+	int depth=0;
+	while (1) {
+		token_t tok = parse_token(parser);
+		switch (tok.ty) {
+			case tok_eof: {
+				if (parser->expansion_stack.length>0) {
+					parser_macro_pop(parser, 1);
+					break;
+				}
+
+				parser->tok_i--;
+				return;
+			}
+			case tok_lbrace: depth++; break;
+			case tok_rbrace: {
+				if (depth==0 && !top) {
+					parser->tok_i--;
+					return;
+				}
+
+				if (depth==0 || --depth==0) return;
+				break;
+			}
+			case tok_end: {
+				if (depth==0) return;
+				break;
+			}
+			default:;
+		}
+	}
+}
+
+//starts a statement/declaration that can be recovered from
+//the caller keeps the save, syntax errors can pop it off the stack
+parser_save_t parser_start_recover(parser_t* parser) {
+	parser_start(parser);
+	return *(parser_save_t*)vector_get(&parser->stack.vec, parser->stack.vec.length-1);
+}
+
+//if new errors were reported since errors_i (and not already recovered from),
+//rewinds to the start, keeps the first error and skips ahead
+int parser_recover(parser_t* parser, parser_save_t* save, unsigned stack_len, unsigned errors_i, int top) {
+	if (errors_i<parser->recovered) errors_i=parser->recovered;
+	if (parser->exhausted) {
+		vector_truncate(&parser->stack.vec, stack_len);
+		return 0;
+	}
+
+	if (parser->errors.length<=errors_i) {
+		vector_truncate(&parser->stack.vec, stack_len);
+		return 0;
+	}
+
+	vector_truncate(&parser->stack.vec, stack_len);
+	vector_pushcpy(&parser->stack.vec, save);
+	parser_cancel(parser);
+
+	vector_truncate(&parser->errors, errors_i+1);
+	parser->recovered = parser->errors.length;
+
+	parser_skip_stmt(parser, top);
+	return 1;
+}
+
 int parse_block(parser_t* parser) {
 	if (!parser_expectstart_pp(parser, tok_lbrace)) return 0;
 
-	if (!parser_expect_pp(parser, tok_rbrace, 0))
-		while (!parser_expect_pp(parser, tok_rbrace, 0)) {
-			parse_stmt(parser);
+	while (!parser_expect_pp(parser, tok_rbrace, 0)) {
+		if (parser_peek_pp(parser, tok_eof, 1)) {
+			parser_error(parser, parser_current(parser), "unterminated block", 1);
+			break;
 		}
 
+		unsigned errors_i = parser->errors.length;
+		unsigned stack_len = parser->stack.vec.length;
+		parser_save_t save = parser_start_recover(parser);
+		parse_stmt(parser);
+		parser_recover(parser, &save, stack_len, errors_i, 0);
+	}
+
 	parser_push(parser, item_block, 0);
 
 	return 1;
@@ -1396,26 +1682,607 @@ parser_t parser_new(char* txt) {
 			.expansions_i=0,
 			.expansions=vector_new(sizeof(parser_expansion_t)),
 			.expansion_stack=vector_new(sizeof(unsigned)),
-			.expansion_save=vector_new(sizeof(vector_t))
+			.expansion_save=vector_new(sizeof(vector_t)),
+			.arg_strs=vector_new(sizeof(char*)),
+
+			.gen_pool=vector_new(sizeof(item_t*)),
+			.decls=vector_new(sizeof(parser_decl_t)),
+			.source_cap=0, .line_starts=vector_new(sizeof(unsigned)),
+
+			.limits=PARSER_LIMITS_DEFAULT, .start_time=parser_time()
 	};
 
 	map_configure_sized_key(&p.macros, sizeof(item_t*));
 	return p;
 }
 
-parser_t parse_file(char* filename) {
+//boundaries are only recorded outside of branches and expansions
+parser_decl_t* parser_push_decl(parser_t* parser) {
+	if (parser->expansion_stack.length>0 || parser->current_if!=-1) return NULL;
+
+	token_t* prev = vector_get(&parser->tokens, parser->tok_i-1);
+	if (prev && prev->t!=parser->source) return NULL;
+
+	return vector_pushcpy(&parser->decls, &(parser_decl_t){
+		.tok_i=parser->tok_i, .item_i=parser->items.length, .item_pool_i=parser->item_pool.length,
+		.errors_i=parser->errors.length, .ifs_i=parser->ifs.length, .expansions_i=parser->expansions_i,
+		.src_i=prev ? prev->start+prev->len : 0
+	});
+}
+
+//parses declarations until eof, or a boundary ending at src_i (returns 1)
+//errors are recovered from by skipping the declaration
+int parse_decls(parser_t* parser, unsigned src_i) {
+	while (1) {
+		parser_decl_t* decl = parser_push_decl(parser);
+		if (decl && decl->src_i==src_i) {
+			vector_pop(&parser->decls);
+			return 1;
+		}
+
+		if (parser_expect_pp(parser, tok_eof, 0)) return 0;
+
+		//report every bad declaration in one pass
+		unsigned errors_i = parser->errors.length;
+		unsigned stack_len = parser->stack.vec.length;
+		parser_save_t save = parser_start_recover(parser);
+		parse_decl(parser);
+		parser_recover(parser, &save, stack_len, errors_i, 1);
+	}
+}
+
+//looks for defer outside of comments and strings
+//strstr/strcspn do the scanning, which are vectorized by any reasonable libc
+int source_has_defer(char* txt) {
+	char* x=txt;
+	char* lit=txt+strcspn(txt, "\"'/"); //next possible comment/string
+	char* cand;
+
+	while ((cand=strstr(x, "defer"))) {
+		//skip every comment/string starting before the candidate
+		while (lit<cand) {
+			char* end;
+			if (lit[0]=='/' && lit[1]=='/') {
+				end=strchr(lit, '\n');
+			} else if (lit[0]=='/' && lit[1]=='*') {
+				end=strstr(lit+2, "*/");
+				if (end) end++;
+			} else if (lit[0]=='/') {
+				end=lit;
+			} else {
+				end=lit+1;
+				while (*end && *end!=*lit) {
+					if (*end=='\\' && end[1]) end++;
+					end++;
+				}
+
+				if (!*end) end=NULL;
+			}
+
+			if (!end) return 0;
+
+			if (end+1>x) x=end+1;
+			lit=end+1+strcspn(end+1, "\"'/");
+		}
+
+		if (cand>=x) {
+			//errdefer too
+			char* start = cand-txt>=3 && strncmp(cand-3, "err", 3)==0 ? cand-3 : cand;
+			int before = start>txt && (start[-1]=='_' || isalnum(start[-1]));
+			int after = cand[5]=='_' || isalnum(cand[5]);
+			if (!before && !after) return 1;
+
+			x=cand+5;
+		}
+	}
+
+	return 0;
+}
+
+parser_t parse_file(char* filename, parser_limits_t limits) {
 	parser_t parser = parser_new(read_file(filename));
+	parser.limits = limits;
 
-	while (!parser_expect_pp(&parser, tok_eof, 0)) {
-		if (!parse_decl(&parser)) break;
+	//nothing to lower, source is copied as-is when emitting
+	if (!source_has_defer(parser.source)) {
+		parser.passthrough=1;
+		return parser;
 	}
 
+	parse_decls(&parser, -1);
 	return parser;
 }
 
+//moves everything after decl into a detached parser, with indices relative to decl
+parser_t parser_detach(parser_t* parser, unsigned decl_i) {
+	parser_decl_t decl = *(parser_decl_t*)vector_get(&parser->decls, decl_i);
+
+	parser_t from = {
+		.tokens=vector_new(sizeof(token_t)), .items=vector_new(sizeof(item_t*)),
+		.item_pool=vector_new(sizeof(item_t*)), .errors=vector_new(sizeof(parser_error_t)),
+		.ifs=vector_new(sizeof(parser_if_t)), .decls=vector_new(sizeof(parser_decl_t))
+	};
+
+	if (parser->tokens.length>decl.tok_i)
+		vector_stockcpy(&from.tokens, parser->tokens.length-decl.tok_i, vector_get(&parser->tokens, decl.tok_i));
+	if (parser->items.length>decl.item_i)
+		vector_stockcpy(&from.items, parser->items.length-decl.item_i, vector_get(&parser->items, decl.item_i));
+	if (parser->item_pool.length>decl.item_pool_i)
+		vector_stockcpy(&from.item_pool, parser->item_pool.length-decl.item_pool_i, vector_get(&parser->item_pool, decl.item_pool_i));
+	if (parser->errors.length>decl.errors_i)
+		vector_stockcpy(&from.errors, parser->errors.length-decl.errors_i, vector_get(&parser->errors, decl.errors_i));
+	if (parser->ifs.length>decl.ifs_i)
+		vector_stockcpy(&from.ifs, parser->ifs.length-decl.ifs_i, vector_get(&parser->ifs, decl.ifs_i));
+	vector_stockcpy(&from.decls, parser->decls.length-decl_i, vector_get(&parser->decls, decl_i));
+
+	vector_truncate(&parser->tokens, decl.tok_i);
+	vector_truncate(&parser->items, decl.item_i);
+	vector_truncate(&parser->item_pool, decl.item_pool_i);
+	vector_truncate(&parser->errors, decl.errors_i);
+	vector_truncate(&parser->ifs, decl.ifs_i);
+	vector_truncate(&parser->decls, decl_i);
+
+	vector_iterator pool_iter = vector_iterate(&from.item_pool);
+	while (vector_next(&pool_iter)) {
+		item_t* item = *(item_t**)pool_iter.x;
+		item->span.start-=decl.tok_i;
+		item->span.end-=decl.tok_i;
+		if (item->if_stack!=-1) item->if_stack-=decl.ifs_i;
+	}
+
+	vector_iterator err_iter = vector_iterate(&from.errors);
+	while (vector_next(&err_iter)) {
+		parser_error_t* err = err_iter.x;
+		err->span.start-=decl.tok_i;
+		err->span.end-=decl.tok_i;
+	}
+
+	vector_iterator if_iter = vector_iterate(&from.ifs);
+	while (vector_next(&if_iter)) {
+		parser_if_t* p_if = if_iter.x;
+		p_if->tok_i-=decl.tok_i;
+		if (p_if->parent!=-1) p_if->parent-=decl.ifs_i;
+	}
+
+	vector_iterator decl_iter = vector_iterate(&from.decls);
+	while (vector_next(&decl_iter)) {
+		parser_decl_t* d = decl_iter.x;
+		d->tok_i-=decl.tok_i;
+		d->item_i-=decl.item_i;
+		d->item_pool_i-=decl.item_pool_i;
+		d->errors_i-=decl.errors_i;
+		d->ifs_i-=decl.ifs_i;
+	}
+
+	return from;
+}
+
+//frees a detached chunk along with its items
+void parser_drop(parser_t* from) {
+	parser_trunc_items(from, 0);
+
+	vector_free(&from->tokens);
+	vector_free(&from->items);
+	vector_free(&from->item_pool);
+	vector_free(&from->errors);
+	vector_free(&from->ifs);
+	vector_free(&from->decls);
+}
+
+//appends a detached/separately parsed chunk, consuming it
+//tokens in from_src are moved to the parser's source, offset by src_off
+void parser_append(parser_t* parser, parser_t* from, char* from_src, unsigned src_off) {
+	unsigned tok_off=parser->tokens.length, ifs_off=parser->ifs.length;
+
+	vector_iterator tok_iter = vector_iterate(&from->tokens);
+	while (vector_next(&tok_iter)) {
+		token_t* tok = tok_iter.x;
+		if (tok->t==from_src) {
+			tok->t=parser->source;
+			tok->start+=src_off;
+			tok->strstart+=src_off;
+		}
+	}
+
+	vector_iterator pool_iter = vector_iterate(&from->item_pool);
+	while (vector_next(&pool_iter)) {
+		item_t* item = *(item_t**)pool_iter.x;
+		item->span.start+=tok_off;
+		item->span.end+=tok_off;
+		if (item->if_stack!=-1) item->if_stack+=ifs_off;
+	}
+
+	vector_iterator err_iter = vector_iterate(&from->errors);
+	while (vector_next(&err_iter)) {
+		parser_error_t* err = err_iter.x;
+		err->span.start+=tok_off;
+		err->span.end+=tok_off;
+		if (err->stop) parser->stop=1;
+	}
+
+	vector_iterator if_iter = vector_iterate(&from->ifs);
+	while (vector_next(&if_iter)) {
+		parser_if_t* p_if = if_iter.x;
+		p_if->tok_i+=tok_off;
+		if (p_if->parent!=-1) p_if->parent+=ifs_off;
+	}
+
+	vector_iterator decl_iter = vector_iterate(&from->decls);
+	while (vector_next(&decl_iter)) {
+		parser_decl_t* d = decl_iter.x;
+		d->tok_i+=tok_off;
+		d->item_i+=parser->items.length;
+		d->item_pool_i+=parser->item_pool.length;
+		d->errors_i+=parser->errors.length;
+		d->ifs_i+=ifs_off;
+		d->src_i+=src_off;
+		d->expansions_i=parser->expansions_i;
+	}
+
+	if (from->tokens.length) vector_stockcpy(&parser->tokens, from->tokens.length, vector_get(&from->tokens, 0));
+	if (from->items.length) vector_stockcpy(&parser->items, from->items.length, vector_get(&from->items, 0));
+	if (from->item_pool.length) vector_stockcpy(&parser->item_pool, from->item_pool.length, vector_get(&from->item_pool, 0));
+	if (from->errors.length) vector_stockcpy(&parser->errors, from->errors.length, vector_get(&from->errors, 0));
+	if (from->ifs.length) vector_stockcpy(&parser->ifs, from->ifs.length, vector_get(&from->ifs, 0));
+	if (from->decls.length) vector_stockcpy(&parser->decls, from->decls.length, vector_get(&from->decls, 0));
+
+	parser->tok_i=parser->tokens.length;
+	parser->recovered=parser->errors.length;
+
+	vector_iterator item_iter = vector_iterate(&from->items);
+	while (vector_next(&item_iter)) {
+		item_t* item = *(item_t**)item_iter.x;
+		if (item->ty==item_define) parser_define(parser, item);
+	}
+
+	vector_free(&from->tokens);
+	vector_free(&from->items);
+	vector_free(&from->item_pool);
+	vector_free(&from->errors);
+	vector_free(&from->ifs);
+	vector_free(&from->decls);
+}
+
+//finds top-level boundaries (after ; or a function body) past the last directive
+//returns where the last directive ends, everything before must be parsed sequentially
+unsigned parser_split(char* txt, vector_t* bounds) {
+	unsigned pp_end=0;
+	int depth=0, line_start=1, fn_body=0;
+	char prev=0; //last significant character
+
+	for (char* x=txt; *x; x++) {
+		switch (*x) {
+			case '\n': line_start=1; continue;
+			case '\r': case '\t': case ' ': continue;
+			case '#': {
+				if (!line_start) break;
+
+				while (*x && (*x!='\n' || x[-1]=='\\')) x++;
+				pp_end=x-txt;
+				vector_clear(bounds);
+
+				if (!*x) return pp_end;
+				continue;
+			}
+			case '/': {
+				if (x[1]=='/') {
+					while (x[1] && x[1]!='\n') x++;
+					continue;
+				} else if (x[1]=='*') {
+					char* end = strstr(x+2, "*/");
+					if (!end) return pp_end;
+					x=end+1;
+					continue;
+				}
+
+				break;
+			}
+			case '"': case '\'': {
+				char* end=x+1;
+				while (*end && *end!=*x) {
+					if (*end=='\\' && end[1]) end++;
+					end++;
+				}
+
+				if (!*end) return pp_end;
+				x=end;
+				break;
+			}
+			case '(': case '[': depth++; break;
+			case ')': case ']': depth--; break;
+			case '{': {
+				if (depth==0) fn_body = prev==')';
+				depth++;
+				break;
+			}
+			case '}': {
+				depth--;
+				if (depth==0 && fn_body) vector_pushcpy(bounds, &(unsigned){x-txt+1});
+				break;
+			}
+			case ';': {
+				if (depth==0) vector_pushcpy(bounds, &(unsigned){x-txt+1});
+				break;
+			}
+			default:;
+		}
+
+		line_start=0;
+		prev=*x;
+	}
+
+	return pp_end;
+}
+
+typedef struct {
+	unsigned start, end;
+	char* t;
+	parser_t parser;
+} parser_chunk_t;
+
+typedef struct {
+	parser_t* parser;
+	vector_t chunks;
+	atomic_uint next;
+	parser_shared_t shared;
+} parser_jobs_t;
+
+void* parse_chunk_worker(void* arg) {
+	parser_jobs_t* jobs = arg;
+
+	while (1) {
+		parser_chunk_t* chunk = vector_get(&jobs->chunks, atomic_fetch_add(&jobs->next, 1));
+		if (!chunk) return NULL;
+
+		chunk->t = heapcpysubstr(jobs->parser->source+chunk->start, chunk->end-chunk->start);
+		chunk->parser = parser_new(chunk->t);
+		chunk->parser.limits = jobs->parser->limits;
+		chunk->parser.shared = &jobs->shared;
+		chunk->parser.start_time = jobs->parser->start_time;
+		parser_import_macros(&chunk->parser, jobs->parser);
+
+		parse_decls(&chunk->parser, -1);
+	}
+}
+
+//parses declarations after the last directive concurrently, each chunk with its own parser
+//directives and everything before them are parsed sequentially first, so macros are known
+//chunks never start within a directive's reach, no macro or #if state is carried into them
+//so only the tail of a file gains, none of it if a directive comes last
+parser_t parse_file_parallel(char* filename, parser_limits_t limits, unsigned threads) {
+	parser_t parser = parser_new(read_file(filename));
+	parser.limits = limits;
+
+	if (!source_has_defer(parser.source)) {
+		parser.passthrough=1;
+		return parser;
+	}
+
+	vector_t bounds = vector_new(sizeof(unsigned));
+	parser_split(parser.source, &bounds);
+
+	if (bounds.length<2) {
+		vector_free(&bounds);
+		parse_decls(&parser, -1);
+		return parser;
+	}
+
+	unsigned seq_end = *(unsigned*)vector_get(&bounds, 0);
+	if (!parse_decls(&parser, seq_end)) {
+		vector_free(&bounds);
+		return parser;
+	}
+
+	vector_truncate(&parser.tokens, parser.tok_i);
+
+	//a few chunks per thread to even out uneven declarations
+	parser_jobs_t jobs = {.parser=&parser, .chunks=vector_new(sizeof(parser_chunk_t))};
+	atomic_init(&jobs.next, 0);
+	atomic_init(&jobs.shared.tokens, parser.tokens.length);
+	atomic_init(&jobs.shared.backtracks, parser.backtracks);
+
+	unsigned chunk_len = (parser.len-seq_end)/(threads*4)+1;
+	unsigned start = seq_end;
+
+	vector_iterator bound_iter = vector_iterate(&bounds);
+	while (vector_next(&bound_iter)) {
+		unsigned bound = *(unsigned*)bound_iter.x;
+		if (bound-start>=chunk_len) {
+			vector_pushcpy(&jobs.chunks, &(parser_chunk_t){.start=start, .end=bound});
+			start=bound;
+		}
+	}
+
+	vector_pushcpy(&jobs.chunks, &(parser_chunk_t){.start=start, .end=parser.len});
+	vector_free(&bounds);
+
+	pthread_t* workers = heap(sizeof(pthread_t)*threads);
+	for (unsigned i=0; i<threads; i++) pthread_create(&workers[i], NULL, parse_chunk_worker, &jobs);
+	for (unsigned i=0; i<threads; i++) pthread_join(workers[i], NULL);
+	drop(workers);
+
+	vector_iterator chunk_iter = vector_iterate(&jobs.chunks);
+	while (vector_next(&chunk_iter)) {
+		parser_chunk_t* chunk = chunk_iter.x;
+		parser_t* cp = &chunk->parser;
+
+		//only the last chunk ends at eof
+		if (chunk_iter.i<jobs.chunks.length-1) {
+			token_t* last = vector_get(&cp->tokens, cp->tokens.length-1);
+			if (last && last->ty==tok_eof) {
+				vector_pop(&cp->tokens);
+
+				parser_decl_t* decl = vector_get(&cp->decls, cp->decls.length-1);
+				if (decl && decl->tok_i==cp->tokens.length) vector_pop(&cp->decls);
+			}
+		}
+
+		parser_append(&parser, cp, chunk->t, chunk->start);
+		parser.backtracks += cp->backtracks;
+
+		//appended tokens still point into them
+		if (cp->arg_strs.length) vector_stockcpy(&parser.arg_strs, cp->arg_strs.length, vector_get(&cp->arg_strs, 0));
+		vector_free(&cp->arg_strs);
+
+		map_free(&cp->macros);
+		vector_free(&cp->stack.vec);
+		vector_free(&cp->expansions);
+		vector_free(&cp->expansion_stack);
+		vector_free(&cp->expansion_save);
+		vector_free(&cp->gen_pool);
+		drop(chunk->t);
+	}
+
+	vector_free(&jobs.chunks);
+	return parser;
+}
+
+//parses a source that was passed through for having no defers, when it is needed anyway
+void parse_passthrough(parser_t* parser) {
+	parser->passthrough=0;
+	parser->t=parser->source;
+	parser->i=0;
+
+	parse_decls(parser, -1);
+}
+
+//replaces removed bytes at offset with inserted, reparsing only the declarations in between
+//returns the range of new top-level items, which have yet to be processed
+span_t parser_edit(parser_t* parser, unsigned offset, unsigned removed, char* inserted) {
+	unsigned inserted_len = strlen(inserted);
+	unsigned len = parser->len-removed+inserted_len;
+
+	//edit in place if possible so that tokens before the edit remain valid
+	char* old_source = parser->source;
+	int owned = parser->source_cap>0;
+	if (parser->source_cap<=len) {
+		parser->source_cap = len*2+1;
+		parser->source = heap(parser->source_cap);
+		memcpy(parser->source, old_source, offset);
+	}
+
+	memmove(parser->source+offset+inserted_len, old_source+offset+removed, parser->len-offset-removed+1);
+	memcpy(parser->source+offset, inserted, inserted_len);
+	parser->len = len;
+	vector_clear(&parser->line_starts);
+
+	if (parser->passthrough) {
+		if (owned && old_source!=parser->source) drop(old_source);
+		if (!source_has_defer(parser->source)) return (span_t){.start=0, .end=0};
+
+		parse_passthrough(parser);
+		return (span_t){.start=0, .end=parser->items.length};
+	}
+
+	//last boundary before the edit, and the first after it
+	//boundaries are where the previous token ends, so one right at the edit may not be found again
+	unsigned from_i=0, to_i=-1;
+	vector_iterator decl_iter = vector_iterate(&parser->decls);
+	while (vector_next(&decl_iter)) {
+		parser_decl_t* decl = decl_iter.x;
+		if (decl->src_i<offset) from_i=decl_iter.i;
+		else if (decl_iter.i>from_i && decl->src_i>offset+removed) {
+			to_i=decl_iter.i;
+			break;
+		}
+	}
+
+	parser_decl_t from = *(parser_decl_t*)vector_get(&parser->decls, from_i);
+
+	parser_t rest = {0};
+	unsigned rest_src_i = -1, rest_ifs_i = -1, rest_tok_i = -1;
+	if (to_i!=-1) {
+		parser_decl_t* to = vector_get(&parser->decls, to_i);
+		rest_src_i = to->src_i-removed+inserted_len;
+		rest_ifs_i = to->ifs_i;
+		rest_tok_i = to->tok_i;
+
+		rest = parser_detach(parser, to_i);
+	}
+
+	//everything between the boundaries is reparsed
+	parser_t stale = parser_detach(parser, from_i);
+	parser_drop(&stale);
+	vector_truncate(&parser->expansions, from.expansions_i);
+	vector_clear(&parser->stack.vec);
+	vector_clear(&parser->expansion_stack);
+
+	if (old_source!=parser->source) {
+		vector_iterator tok_iter = vector_iterate(&parser->tokens);
+		while (vector_next(&tok_iter)) {
+			token_t* tok = tok_iter.x;
+			if (tok->t==old_source) tok->t=parser->source;
+		}
+	}
+
+	map_clear(&parser->macros);
+	vector_iterator item_iter = vector_iterate(&parser->items);
+	while (vector_next(&item_iter)) {
+		item_t* item = *(item_t**)item_iter.x;
+		if (item->ty==item_define) parser_define(parser, item);
+	}
+
+	parser->stop=0;
+	parser->recovered=parser->errors.length;
+	vector_iterator err_iter = vector_iterate(&parser->errors);
+	while (vector_next(&err_iter)) {
+		if (((parser_error_t*)err_iter.x)->stop) parser->stop=1;
+	}
+
+	parser->t = parser->source;
+	parser->i = from.src_i;
+	parser->tok_i = from.tok_i;
+	parser->expansions_i = from.expansions_i;
+	parser->current_if = -1;
+	parser->in_define = 0;
+	parser->in_include = 0;
+
+	span_t reparsed = {.start=from.item_i};
+
+	//resynchronize at the old boundary if the preprocessor state matches
+	int resync = parse_decls(parser, rest_src_i);
+	if (resync && parser->ifs.length==rest_ifs_i) {
+		vector_truncate(&parser->tokens, parser->tok_i);
+		reparsed.end = parser->items.length;
+
+		//generated items already in the tail are attributed to its tokens, which move along with it
+		vector_iterator gen_iter = vector_iterate(&parser->gen_pool);
+		while (vector_next(&gen_iter)) {
+			item_t* item = *(item_t**)gen_iter.x;
+			if (item->gen_tok!=-1 && item->gen_tok>=rest_tok_i) item->gen_tok += parser->tok_i-rest_tok_i;
+		}
+
+		parser_append(parser, &rest, old_source, inserted_len-removed);
+	} else {
+		//ran past it, or the #if state differs there, so the old declarations are stale
+		if (to_i!=-1) parser_drop(&rest);
+		if (resync) parse_decls(parser, -1);
+
+		reparsed.end = parser->items.length;
+	}
+
+	if (owned && old_source!=parser->source) drop(old_source);
+	return reparsed;
+}
+
 void parser_free(parser_t* parser) {
 	parser_trunc_items(parser, 0);
 
+	vector_iterator gen_iter = vector_iterate(&parser->gen_pool);
+	while (vector_next(&gen_iter)) {
+		item_free(*(item_t**)gen_iter.x);
+	}
+
+	vector_free(&parser->gen_pool);
+
+	vector_iterator str_iter = vector_iterate(&parser->arg_strs);
+	while (vector_next(&str_iter)) drop(*(char**)str_iter.x);
+	vector_free(&parser->arg_strs);
+
+	vector_free(&parser->decls);
+	vector_free(&parser->line_starts);
+	if (parser->source_cap) drop(parser->source);
+
 	vector_free(&parser->items);
 	vector_free(&parser->tokens);
 	vector_free(&parser->ifs);
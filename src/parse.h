@@ -3,16 +3,22 @@
 #pragma once
 #include <stdio.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 #include "util.h"
 #include "vector.h"
 #include "hashtable.h"
 #include "types.h"
 span_t parser_current(parser_t* parser);
 void parser_error(parser_t* parser, span_t span, char* err, int stop);
+double parser_time();
+void parser_exhaust(parser_t* parser, char* limit);
+void parser_check_time(parser_t* parser);
 void parser_printerr(parser_t* parser, parser_error_t* perr);
 void print_item(parser_t* parser, FILE* f, item_t* item);
 char* item_str(parser_t* parser, item_t* item);
-void print_item_tree_rec(parser_t* parser, vector_t* items, int depth);
+unsigned parser_line(parser_t* parser, unsigned tok_i);
 void print_item_tree(parser_t* parser);
 int parser_ncmp(parser_t* parser, char* x);
 int skip_comment(parser_t* parser);
@@ -36,11 +42,15 @@ void parser_macro_pop(parser_t* parser, unsigned len);
 void parser_restore(parser_t* parser, parser_save_t* save);
 void parser_cancel(parser_t* parser);
 void parser_finish(parser_t* parser);
+unsigned hash_bytes(unsigned h, char* x, unsigned len);
+unsigned item_hash(parser_t* parser, item_t* item);
 item_t* parser_wrap(parser_t* parser, item_ty ty, int oob);
 item_t* parser_push(parser_t* parser, item_ty ty, int oob);
 void parser_skip_branch(parser_t* parser);
 void parser_push_ifdir(parser_t* parser, item_ty ty, int branch);
 int parser_parse_if(parser_t* parser);
+void parser_define(parser_t* parser, item_t* define);
+void parser_import_macros(parser_t* parser, parser_t* from);
 void parser_handle_macros(parser_t* parser);
 void parser_handle_pp(parser_t* parser);
 int parser_expect_pp(parser_t* parser, token_ty ty, int err);
@@ -56,8 +66,33 @@ void parse_expr(parser_t* parser, int allow_comma, int optional);
 int parse_ty(parser_t* parser, int named);
 int parse_var(parser_t* parser);
 void parse_stmt(parser_t* parser);
+void parser_skip_stmt(parser_t* parser, int top);
+parser_save_t parser_start_recover(parser_t* parser);
+int parser_recover(parser_t* parser, parser_save_t* save, unsigned stack_len, unsigned errors_i, int top);
 int parse_block(parser_t* parser);
 int parse_decl(parser_t* parser);
 parser_t parser_new(char* txt);
-parser_t parse_file(char* filename);
+parser_decl_t* parser_push_decl(parser_t* parser);
+int parse_decls(parser_t* parser, unsigned src_i);
+int source_has_defer(char* txt);
+parser_t parse_file(char* filename, parser_limits_t limits);
+parser_t parser_detach(parser_t* parser, unsigned decl_i);
+void parser_drop(parser_t* from);
+void parser_append(parser_t* parser, parser_t* from, char* from_src, unsigned src_off);
+unsigned parser_split(char* txt, vector_t* bounds);
+typedef struct {
+	unsigned start, end;
+	char* t;
+	parser_t parser;
+} parser_chunk_t;
+typedef struct {
+	parser_t* parser;
+	vector_t chunks;
+	atomic_uint next;
+	parser_shared_t shared;
+} parser_jobs_t;
+void* parse_chunk_worker(void* arg);
+parser_t parse_file_parallel(char* filename, parser_limits_t limits, unsigned threads);
+void parse_passthrough(parser_t* parser);
+span_t parser_edit(parser_t* parser, unsigned offset, unsigned removed, char* inserted);
 void parser_free(parser_t* parser);
@@ -1,37 +1,59 @@
 //THERES NO TREE ITS JUST SOME TAGSE ON SOME TOKNEs
 
 #include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <fnmatch.h>
+#include <ctype.h>
 #include <util.h>
 
 #include "types.h"
 #include "parse.h"
 
+//compares structure and the text of leaves
+//parsed items with different hashes cant be equal, so those are rejected without walking them
 int item_eq(parser_t* parser, item_t* i1, item_t* i2) {
-	if (i1->ty!=i2->ty || i1->body.length!=i2->body.length) return 0;
-
-	if (i1->body.length==0) {
-		if (i1->ty!=item_name && i1->ty!=item_literal_str) return 1;
-		token_t* start1 = vector_get(&parser->tokens, i1->span.start), *end1 = vector_get(&parser->tokens, i1->span.end);
-		token_t* start2 = vector_get(&parser->tokens, i2->span.start), *end2 = vector_get(&parser->tokens, i2->span.end);
-		if (end1->len+end1->start!=end2->len+end2->start || start1->start!=start2->start) return 0;
-		return strncmp(parser->t+start1->start, parser->t+start2->start, end1->len+end1->start-start1->start);
-	} else {
-		vector_iterator body_iter = vector_iterate(&i1->body);
-		while (vector_next(&body_iter)) {
-			item_t* i1b=body_iter.x;
-			item_t* i2b=vector_get(&i2->body, body_iter.i);
-			if (!item_eq(parser, i1b, i2b)) return 0;
+	if (!i1->gen && !i2->gen && i1->hash!=i2->hash) return 0;
+
+	vector_t stack = vector_new(sizeof(item_t*[2]));
+	vector_pushcpy(&stack, (item_t*[2]){i1, i2});
+
+	int eq=1;
+	while (eq && stack.length>0) {
+		item_t** pair = vector_get(&stack, stack.length-1);
+		i1=pair[0]; i2=pair[1];
+		vector_pop(&stack);
+
+		if (i1->ty!=i2->ty || i1->body.length!=i2->body.length) {
+			eq=0;
+		} else if (i1->body.length==0 && (i1->gen || i2->gen)) {
+			//generated leaves have no tokens, only their text
+			eq = i1->gen && i2->gen && strcmp(i1->str ? i1->str : "", i2->str ? i2->str : "")==0;
+		} else if (i1->body.length==0) {
+			char* s1 = item_str(parser, i1), *s2 = item_str(parser, i2);
+			eq = strcmp(s1, s2)==0;
+
+			drop(s1);
+			drop(s2);
+		} else {
+			for (unsigned i=0; i<i1->body.length; i++) {
+				vector_pushcpy(&stack, (item_t*[2]){*(item_t**)vector_get(&i1->body, i), *(item_t**)vector_get(&i2->body, i)});
+			}
 		}
 	}
 
-	return 1;
+	vector_free(&stack);
+	return eq;
 }
 
+//generated items have no ordinals, so their parents are followed instead
 int item_child(item_t* item, item_t* child) {
-	vector_iterator child_iter = vector_iterate(&item->body);
-	while (vector_next(&child_iter)) {
-		item_t* child_item = *(item_t**)child_iter.x;
-		if (child_item==child || item_child(child_item, child)) return 1;
+	if (item->pre && child->pre)
+		return child->pre>item->pre && child->pre<=item->post;
+
+	for (child=child->parent; child; child=child->parent) {
+		if (child==item) return 1;
 	}
 
 	return 0;
@@ -42,10 +64,12 @@ typedef struct {
 	vector_t stack; //item_t** within body
 	item_t** x_ref;
 	item_t* x;
+
+	unsigned end; //top-level items past this are not iterated
 } item_iterator_t;
 
 item_iterator_t item_iterate(parser_t* parser) {
-	return (item_iterator_t){.parser=parser, .stack=vector_new(sizeof(item_t**)), .x_ref=(item_t**)vector_get(&parser->items, 0)-1};
+	return (item_iterator_t){.parser=parser, .stack=vector_new(sizeof(item_t**)), .x_ref=(item_t**)vector_get(&parser->items, 0)-1, .end=-1};
 }
 
 void item_restart(item_iterator_t* iter) {
@@ -72,7 +96,7 @@ item_t** item_peek_ref(item_iterator_t* iter, unsigned i) {
 		}
 	} else {
 		unsigned top_i = (iter->x_ref+i)-(item_t**)vector_get(&iter->parser->items, 0);
-		if (top_i>=iter->parser->items.length) return NULL;
+		if (top_i>=iter->parser->items.length || top_i>=iter->end) return NULL;
 		else return iter->x_ref+i;
 	}
 }
@@ -112,6 +136,11 @@ void item_set(item_iterator_t* iter, item_t* item) {
 	iter->x = item;
 }
 
+unsigned item_index(item_iterator_t* iter) {
+	item_t* parent = item_parent(iter);
+	return iter->x_ref-(item_t**)vector_get(parent ? &parent->body : &iter->parser->items, 0);
+}
+
 void item_remove(item_iterator_t* iter) {
 	item_t* parent = item_parent(iter);
 	unsigned i = iter->x_ref-(item_t**)vector_get(&parent->body, 0);
@@ -146,12 +175,55 @@ void item_iterator_free(item_iterator_t* iter) {
 	vector_free(&iter->stack);
 }
 
+//pending change to a body, applied along with the rest of the body's in splice_apply
+typedef struct {
+	item_t* parent;
+	unsigned i; //index into the body as it was before splicing
+	item_t* item;
+
+	char replace; //replaces the item at i, otherwise inserted before it
+	char decl; //inserted before everything else at i, so that it is in scope there
+	unsigned order;
+} splice_t;
+
+//increment of an exit's counter, numbered once every function is processed
+typedef struct {
+	item_t* item;
+	unsigned tok; //line is looked up after, parser_line isnt thread safe
+	char* kind;
+} exit_counter_t;
+
+//deferred statement placed for an exit, for --bloat-report
+//a copy run by several exits is recorded for each, only the first is marked
+typedef struct {
+	item_t* defer, *deferred;
+	char copy; //first record of a copy, 0 for others and for defers only taken out
+	unsigned tok; //exit or end of scope, -1 if none
+	char* kind;
+} bloat_t;
+
+//a bloat_t with its function, sorted so each function's and then each defer's records are together
+typedef struct {
+	item_t* func, *defer;
+	unsigned i; //in proc->bloat, order within a defer
+} bloat_ref_t;
+
 typedef struct {
 	vector_t objs; //pointers to allocated objects (above)
-	vector_t names;
 
-	map_t name_label;
-	map_t name_item;
+	vector_t walk; //item_t*, scratch stack for tree walks outside of iter
+	unsigned ordinal; //last pre-order number handed out by tag_items
+	vector_t splices; //splice_t, for the scope being lowered
+	vector_t counters; //exit_counter_t, with --count-exits
+	vector_t bloat; //bloat_t, with --bloat-report
+	unsigned fn_defers; //defers seen in the current function, for generated names
+	unsigned fn_colds; //cold exit labels in the current function, numbered for the same
+	unsigned fn_ladders; //ladder labels in the current function, likewise
+	char fn_ret; //some return in the current function goes through its return slot
+
+	process_opts_t opts;
+
+	symtab_t syms; //labels of the current function
 
 	item_iterator_t iter;
 
@@ -160,6 +232,7 @@ typedef struct {
 
 item_t* scope_get(item_t* item) {
 	if (!item) return NULL;
+	if (item->pre) return item->scope_parent;
 
 	while (1) {
 		item=item->parent;
@@ -182,392 +255,2071 @@ item_t* item_iter_scope(item_iterator_t* iter) {
 	}
 }
 
-scope_t* scope_new(process_t* proc) {
-	scope_t* sc = heapcpy(sizeof(scope_t), &(scope_t){.name_i=proc->names.length,
-			.deferred=vector_new(sizeof(item_t*)), .exits=vector_new(sizeof(exit_t)),
-			.ret=0, .br=0});
+symtab_t symtab_new() {
+	symtab_t tab = {.cap=64, .shadowed=vector_new(sizeof(sym_t)), .open=vector_new(sizeof(unsigned))};
+	tab.slots = heap(sizeof(sym_t)*tab.cap);
+	memset(tab.slots, 0, sizeof(sym_t)*tab.cap);
+	return tab;
+}
 
-	vector_pushcpy(&proc->objs, &sc);
-	proc->iter.x->scope=sc;
-	return sc;
+//entering the outermost scope makes everything stale, so hidden entries can be dropped too
+void sym_enter(symtab_t* tab) {
+	if (tab->open.length==0) {
+		vector_iterator shadow_iter = vector_iterate(&tab->shadowed);
+		while (vector_next(&shadow_iter)) drop(((sym_t*)shadow_iter.x)->name);
+
+		vector_clear(&tab->shadowed);
+	}
+
+	vector_pushcpy(&tab->open, &(unsigned){++tab->stamp});
+}
+
+//O(1), entries of the scope are left to be ignored or overwritten
+void sym_exit(symtab_t* tab) {
+	vector_pop(&tab->open);
+}
+
+int sym_live(symtab_t* tab, sym_t* sym) {
+	unsigned* stamp = vector_get(&tab->open, sym->depth);
+	return stamp && *stamp==sym->stamp;
 }
 
-void scope_exit(process_t* proc, scope_t* scope) {
-	vector_iterator name_iter = vector_iterate(&proc->names);
-	name_iter.i=scope->name_i-1;
-	while (vector_next(&name_iter)) {
-		map_remove(&proc->name_item, name_iter.x);
+//the entry, or one it hides, of the same name that is still in scope
+sym_t* sym_visible(symtab_t* tab, sym_t* sym) {
+	char* name = sym->name;
+	while (sym && strcmp(sym->name, name)==0) {
+		if (sym_live(tab, sym)) return sym;
+		sym = sym->shadowed ? vector_get(&tab->shadowed, sym->shadowed-1) : NULL;
 	}
 
-	vector_truncate(&proc->names, scope->name_i);
+	return NULL;
 }
 
-//dead code for now
-int expr_const(item_iterator_t* iter) {
-	while (item_next(iter)) {
-		switch (iter->x->ty) {
-			case item_ternary:
-			case item_expr: {
-				item_descend(iter);
-				if (!expr_const(iter)) {
-					item_ascend(iter);
-					return 0;
-				} else {
-					item_ascend(iter);
-					break;
-				}
-			}
-			case item_name:
-			case item_assignment:
-			case item_fncall: return 0;
-			default:;
+//slot with name or the empty slot ending its probe, reuse is set to the first stale slot on the way
+sym_t* sym_probe(symtab_t* tab, char* name, unsigned hash, sym_t** reuse) {
+	for (unsigned i=hash&(tab->cap-1);; i=(i+1)&(tab->cap-1)) {
+		sym_t* slot = &tab->slots[i];
+		if (!slot->name || (slot->hash==hash && strcmp(slot->name, name)==0)) return slot;
+		if (reuse && !*reuse && !sym_visible(tab, slot)) *reuse=slot;
+	}
+}
+
+item_t* sym_find(symtab_t* tab, char* name) {
+	sym_t* slot = sym_probe(tab, name, hash_bytes(2166136261u, name, strlen(name)), NULL);
+	if (!slot->name) return NULL;
+
+	sym_t* sym = sym_visible(tab, slot);
+	return sym ? sym->item : NULL;
+}
+
+//rehashes what is still visible, stale slots are dropped
+void sym_grow(symtab_t* tab) {
+	sym_t* old = tab->slots;
+	unsigned old_cap = tab->cap;
+
+	tab->cap *= 2;
+	tab->len = 0;
+	tab->slots = heap(sizeof(sym_t)*tab->cap);
+	memset(tab->slots, 0, sizeof(sym_t)*tab->cap);
+
+	for (unsigned i=0; i<old_cap; i++) {
+		if (!old[i].name) continue;
+		if (!sym_visible(tab, &old[i])) {
+			drop(old[i].name);
+			continue;
 		}
+
+		*sym_probe(tab, old[i].name, old[i].hash, NULL) = old[i];
+		tab->len++;
 	}
 
-	return 1;
+	drop(old);
 }
 
-item_t* item_new(process_t* proc, item_ty ty, item_t* inherit, item_t* parent) {
-	item_t* item = heapcpy(sizeof(item_t), &(item_t){.ty=ty,
-			.if_i=inherit ? inherit->if_i : -1,
-			.if_stack=inherit ? inherit->if_stack : -1,
-			.body=vector_new(sizeof(item_t)), .gen=1, .str=NULL, .parent=parent});
+//declares name (taken) in the innermost scope
+//returns the existing entry if it is already declared there, in which case name is not taken
+sym_t* sym_insert(symtab_t* tab, char* name, item_t* item) {
+	if ((tab->len+1)*2>tab->cap) sym_grow(tab);
+
+	unsigned hash = hash_bytes(2166136261u, name, strlen(name));
+	sym_t* reuse = NULL;
+	sym_t* slot = sym_probe(tab, name, hash, &reuse);
+
+	unsigned shadowed=0;
+	if (slot->name) {
+		sym_t* visible = sym_visible(tab, slot);
+		if (visible && visible->depth==tab->open.length-1) return visible;
+
+		vector_pushcpy(&tab->shadowed, slot);
+		shadowed = tab->shadowed.length;
+	} else if (reuse) {
+		drop(reuse->name);
+		slot = reuse;
+	} else {
+		tab->len++;
+	}
 
-	vector_pushcpy(&proc->parser->item_pool, &item);
+	*slot = (sym_t){.name=name, .hash=hash, .item=item, .depth=tab->open.length-1,
+			.stamp=*(unsigned*)vector_get(&tab->open, tab->open.length-1), .shadowed=shadowed};
 
-	return item;
+	return NULL;
 }
 
-item_t* item_push(process_t* proc, item_ty ty, item_t* parent, item_t* inherit) {
-	item_t* item = item_new(proc, ty, inherit, parent);
-	vector_pushcpy(&parent->body, &item);
-	return item;
+void symtab_free(symtab_t* tab) {
+	for (unsigned i=0; i<tab->cap; i++) {
+		if (tab->slots[i].name) drop(tab->slots[i].name);
+	}
+
+	vector_iterator shadow_iter = vector_iterate(&tab->shadowed);
+	while (vector_next(&shadow_iter)) drop(((sym_t*)shadow_iter.x)->name);
+
+	drop(tab->slots);
+	vector_free(&tab->shadowed);
+	vector_free(&tab->open);
 }
 
-//pass 1: instantaniate scope & labels
-//pass 2: populate scope
+scope_t* scope_new(process_t* proc) {
+	scope_t* sc = heapcpy(sizeof(scope_t), &(scope_t){
+			.deferred=vector_new(sizeof(item_t*)), .deferred_err=vector_new(sizeof(char)), .exits=vector_new(sizeof(exit_t)),
+			.labels=vector_new(sizeof(item_t*)), .continues=vector_new(sizeof(exit_t)),
+			.latches=vector_new(sizeof(item_t*)), .ret=0});
 
-int scope_exits_early(process_t* proc, item_t* origin) {
-	if (proc->iter.x->ty==item_block) {
-		scope_t* sc = proc->iter.x->scope;
-		vector_iterator exit_iter = vector_iterate(&sc->exits);
-		while (vector_next(&exit_iter)) {
-			exit_t* exit = exit_iter.x;
-			if (exit->exit_scope==origin || item_child(exit->exit_scope, origin)) return 1;
-		}
+	vector_pushcpy(&proc->objs, &sc);
+	proc->iter.x->scope=sc;
+	return sc;
+}
+
+//labels are per function, gotos and generated labels look them up in syms
+//the function is a new outermost scope, so labels of the last one go stale
+void scope_labels(process_t* proc, scope_t* scope) {
+	vector_clear(&proc->syms.open);
+	sym_enter(&proc->syms);
+
+	vector_iterator label_iter = vector_iterate(&scope->labels);
+	while (vector_next(&label_iter)) {
+		item_t* label = *(item_t**)label_iter.x;
+		char* k = item_str(proc->parser, *(item_t**)vector_get(&label->body, 0));
+		if (sym_insert(&proc->syms, k, label)) drop(k);
 	}
+}
 
-	int exits=0;
-	item_descend(&proc->iter);
+//operators of constant integer expressions
+typedef enum {
+	cop_paren, //not an operator, bottom of a parenthesized group
+	cop_neg, cop_pos, cop_not, cop_compl, //unary
+	cop_mul, cop_div, cop_mod, cop_add, cop_sub, cop_shl, cop_shr,
+	cop_lt, cop_gt, cop_le, cop_ge, cop_eq, cop_ne,
+	cop_and, cop_xor, cop_or, cop_land, cop_lor,
+	cop_cond, cop_else //? and :, : pairs up both branches for ?
+} cop_ty;
 
-	while (item_next(&proc->iter)) {
-		switch (proc->iter.x->ty) {
-			case item_if: {
-				item_t* last = vector_get(&proc->iter.x->body, proc->iter.x->body.length-1);
-				if (last->ty!=item_else) break;
+typedef struct {
+	long long v, other; //other is the else branch of a pair
+	char pair;
+} const_t;
 
-				exits=scope_exits_early(proc, origin);
-				break;
-			}
-			case item_block: {
-				exits=scope_exits_early(proc, origin);
-				break;
-			}
-			default:;
-		}
+typedef struct {
+	item_t* item;
+	unsigned i;
+
+	char group; //pops to its cop_paren when done
+	char ternary; //children are the branches
+	char branches; //of a ternary seen so far
+
+	char operand; //an operand was seen since the last binary operator
+	char binary; //last child was a binary operator, so an expression after it is the rest of the chain
+	char rest; //right hand side of a binary operator was seen, which ends the expression
+} const_frame_t;
+
+//-1 if s isnt an operator of constant expressions
+int cop_parse(char* s, int unary) {
+	if (unary) {
+		if (strcmp(s, "-")==0) return cop_neg;
+		else if (strcmp(s, "+")==0) return cop_pos;
+		else if (strcmp(s, "!")==0) return cop_not;
+		else if (strcmp(s, "~")==0) return cop_compl;
+		else return -1;
+	}
 
-		if (exits) {
-			item_ascend(&proc->iter);
-			return 1;
-		}
+	char* binary[] = {"*", "/", "%", "+", "-", "<<", ">>", "<", ">", "<=", ">=", "==", "!=", "&", "^", "|", "&&", "||"};
+	for (unsigned i=0; i<sizeof(binary)/sizeof(char*); i++) {
+		if (strcmp(s, binary[i])==0) return cop_mul+i;
 	}
 
-	item_ascend(&proc->iter);
-	return 0;
+	return -1;
 }
 
-void tag_items(process_t* proc) {
-	while (item_next(&proc->iter))
-		switch (proc->iter.x->ty) {
-			case item_block: {
-				scope_t* sc = scope_new(proc);
+int cop_prec(cop_ty op) {
+	switch (op) {
+		case cop_paren: return 0;
+		case cop_neg: case cop_pos: case cop_not: case cop_compl: return 12;
+		case cop_mul: case cop_div: case cop_mod: return 11;
+		case cop_add: case cop_sub: return 10;
+		case cop_shl: case cop_shr: return 9;
+		case cop_lt: case cop_gt: case cop_le: case cop_ge: return 8;
+		case cop_eq: case cop_ne: return 7;
+		case cop_and: return 6;
+		case cop_xor: return 5;
+		case cop_or: return 4;
+		case cop_land: return 3;
+		case cop_lor: return 2;
+		case cop_cond: case cop_else: return 1;
+	}
 
-				item_t* parent = item_parent(&proc->iter);
+	return 0;
+}
 
-				sc->ret = parent->ty==item_func;
-				sc->br = parent->ty==item_while || parent->ty==item_for
-						|| parent->ty==item_dowhile || parent->ty==item_while || parent->ty==item_switch;
+//pops the top operator and its operands, pushing the result
+//0 if it cant be evaluated, ie. division by zero or shifts out of range
+int cop_apply(vector_t* ops, vector_t* vals) {
+	cop_ty op = *(cop_ty*)vector_get(ops, ops->length-1);
+	vector_pop(ops);
+
+	unsigned operands = op<=cop_compl ? 1 : 2;
+	if (vals->length<operands) return 0;
+
+	const_t* a = vector_get(vals, vals->length-operands);
+	const_t* b = vector_get(vals, vals->length-1);
+
+	if (op==cop_cond) {
+		if (a->pair || !b->pair) return 0;
+		*a = (const_t){.v=a->v ? b->v : b->other};
+		vector_pop(vals);
+		return 1;
+	} else if (a->pair || b->pair) {
+		return 0;
+	} else if (op==cop_else) {
+		*a = (const_t){.v=a->v, .other=b->v, .pair=1};
+		vector_pop(vals);
+		return 1;
+	}
 
-				item_descend(&proc->iter);
-				tag_items(proc);
-				item_ascend(&proc->iter);
+	//unsigned so overflow wraps instead of being undefined
+	unsigned long long x=a->v, y=b->v;
+	long long r;
+
+	switch (op) {
+		case cop_neg: r=-x; break;
+		case cop_pos: r=x; break;
+		case cop_not: r=!x; break;
+		case cop_compl: r=~x; break;
+		case cop_mul: r=x*y; break;
+		case cop_div: case cop_mod: {
+			if (b->v==0 || (b->v==-1 && a->v==LLONG_MIN)) return 0;
+			r = op==cop_div ? a->v/b->v : a->v%b->v;
+			break;
+		}
+		case cop_add: r=x+y; break;
+		case cop_sub: r=x-y; break;
+		case cop_shl: case cop_shr: {
+			if (b->v<0 || b->v>=64) return 0;
+			r = op==cop_shl ? (long long)(x<<y) : a->v>>b->v;
+			break;
+		}
+		case cop_lt: r=a->v<b->v; break;
+		case cop_gt: r=a->v>b->v; break;
+		case cop_le: r=a->v<=b->v; break;
+		case cop_ge: r=a->v>=b->v; break;
+		case cop_eq: r=a->v==b->v; break;
+		case cop_ne: r=a->v!=b->v; break;
+		case cop_and: r=x&y; break;
+		case cop_xor: r=x^y; break;
+		case cop_or: r=x|y; break;
+		case cop_land: r=a->v && b->v; break;
+		case cop_lor: r=a->v || b->v; break;
+		default: return 0;
+	}
 
-				scope_exit(proc, sc);
+	if (operands==2) vector_pop(vals);
+	((const_t*)vector_get(vals, vals->length-1))->v = r;
+	return 1;
+}
 
-				if (proc->iter.x->ty==item_switch) item_ascend(&proc->iter);
+//applies operators on top of ops binding at least as tightly as prec (or more, if right associative)
+int cop_reduce(vector_t* ops, vector_t* vals, int prec, int right) {
+	while (ops->length>0) {
+		int top = cop_prec(*(cop_ty*)vector_get(ops, ops->length-1));
+		if (top==0 || top<prec || (right && top==prec)) break;
+		if (!cop_apply(ops, vals)) return 0;
+	}
 
-				break;
-			}
+	return 1;
+}
 
-			case item_func: {
-				scope_t* sc = scope_new(proc);
+//evaluates an integer expression of literals, operators and parentheses into out
+//the parser doesnt have precedence (chains nest to the right), so they are flattened here with a shunting yard
+//unsigned or floating literals, names, casts, calls etc. are not constant
+//text of an operator or literal, which is one token
+//its span may start at the name of the macro it was expanded from, in another buffer, so only the last token is read
+char* item_tok_str(parser_t* parser, item_t* item) {
+	token_t* tok = vector_get(&parser->tokens, item->span.end);
+	return heapcpysubstr(tok->t+tok->start, tok->len);
+}
 
-				item_descend(&proc->iter);
-				tag_items(proc);
-				item_ascend(&proc->iter);
+int expr_const(parser_t* parser, item_t* expr, long long* out) {
+	vector_t frames = vector_new(sizeof(const_frame_t));
+	vector_t ops = vector_new(sizeof(cop_ty));
+	vector_t vals = vector_new(sizeof(const_t));
 
-				scope_exit(proc, sc);
-				map_clear(&proc->name_label);
+	vector_pushcpy(&frames, &(const_frame_t){.item=expr});
 
-				break;
-			}
+	int ok=1;
+	while (ok && frames.length>0) {
+		const_frame_t* frame = vector_get(&frames, frames.length-1);
 
-			case item_label: {
-				item_descend(&proc->iter);
-				char* k = item_str(proc->parser, item_get(&proc->iter, 0));
-				item_ascend(&proc->iter);
-				map_insertcpy(&proc->name_label, &k, &proc->iter.x);
-				break;
+		if (frame->i>=frame->item->body.length) {
+			if (frame->group) {
+				ok = cop_reduce(&ops, &vals, 1, 0) && ops.length>0;
+				if (ok) vector_pop(&ops);
 			}
 
-			default: {
-				if (proc->iter.x->body.length>0) {
-					item_descend(&proc->iter);
-					tag_items(proc);
-					item_ascend(&proc->iter);
-				}
-			}
+			vector_pop(&frames);
+			continue;
 		}
-}
 
-void process(process_t* proc);
+		item_t* x = *(item_t**)vector_get(&frame->item->body, frame->i++);
+		if (item_special(x)) continue;
 
-void process_scope(process_t* proc) {
-	scope_t* sc = proc->iter.x->scope;
+		if (frame->ternary) {
+			if (x->ty!=item_expr || frame->branches==2) {
+				ok=0; break;
+			}
 
-	item_descend(&proc->iter);
-	process(proc);
-	item_ascend(&proc->iter);
+			if (frame->branches++==1) {
+				ok = cop_reduce(&ops, &vals, cop_prec(cop_else), 1);
+				vector_pushcpy(&ops, &(cop_ty){cop_else});
+			}
 
-	int defers=0;
-	item_t* scope_item = proc->iter.x;
-	while (scope_item) {
-		if (scope_item->scope->deferred.length) {
-			defers=1; break;
+			vector_pushcpy(&ops, &(cop_ty){cop_paren});
+			vector_pushcpy(&frames, &(const_frame_t){.item=x, .group=1});
+			continue;
 		}
 
-		scope_item=scope_get(scope_item);
-	}
+		//anything after the right hand side is another expression, after a comma
+		if (frame->rest) {
+			ok=0; break;
+		}
 
-	if (!defers) return;
+		switch (x->ty) {
+			case item_op: {
+				char* s = item_tok_str(parser, x);
+				int op = cop_parse(s, !frame->operand);
+				drop(s);
 
-	//if exits are all same, no need for individual treatment
-	//simply use gotos and place the exit at the end of the block after deferred labels
-	int same=1;
+				if (op==-1) {
+					ok=0;
+				} else if (!frame->operand) {
+					vector_pushcpy(&ops, &(cop_ty){op});
+				} else {
+					ok = cop_reduce(&ops, &vals, cop_prec(op), 0);
+					vector_pushcpy(&ops, &(cop_ty){op});
+					frame->operand=0;
+					frame->binary=1;
+				}
 
-	exit_t* ex=NULL;
-	vector_iterator exit_iter = vector_iterate(&sc->exits);
-	while (vector_next(&exit_iter)) {
-		exit_t* prev_ex = ex;
-		ex = exit_iter.x;
-		if (!prev_ex) continue;
+				break;
+			}
+			case item_expr: {
+				//rest of a chain after a binary operator
+				if (frame->binary) {
+					frame->rest=1;
+					vector_pushcpy(&frames, &(const_frame_t){.item=x});
+					break;
+				}
 
-		if (!item_eq(proc->parser, ex->item, prev_ex->item)
-					|| ex->exit_scope!=prev_ex->exit_scope) {
-			same=0;
-			break;
+				//unary operators and parentheses
+				frame->operand=1;
+				vector_pushcpy(&ops, &(cop_ty){cop_paren});
+				vector_pushcpy(&frames, &(const_frame_t){.item=x, .group=1});
+				break;
+			}
+			case item_ternary: {
+				ok = frame->operand && cop_reduce(&ops, &vals, cop_prec(cop_cond), 1);
+				vector_pushcpy(&ops, &(cop_ty){cop_cond});
+				vector_pushcpy(&frames, &(const_frame_t){.item=x, .ternary=1});
+				break;
+			}
+			case item_literal_num: {
+				char* s = item_tok_str(parser, x);
+				char* end;
+				unsigned long long v = strtoull(s, &end, 0);
+
+				//only l suffixes, unsigned comparisons would differ
+				while (*end=='l' || *end=='L') end++;
+				ok = !*end && v<=LLONG_MAX && !frame->operand;
+				drop(s);
+
+				frame->operand=1;
+				vector_pushcpy(&vals, &(const_t){.v=v});
+				break;
+			}
+			default: ok=0;
 		}
 	}
 
-	if (same) {
-		vector_iterator deferred_iter = vector_iterate_end(&sc->deferred);
-		while (vector_prev(&deferred_iter)) {
-			item_t* defer = *(item_t**)deferred_iter.x;
+	if (ok) ok = cop_reduce(&ops, &vals, 1, 0) && ops.length==0 && vals.length==1;
 
-			char* label_str=NULL;
+	const_t* res = vector_get(&vals, 0);
+	if (ok && !res->pair) *out = res->v;
+	else ok=0;
 
-			exit_iter = vector_iterate(&sc->exits);
-			while (vector_next(&exit_iter)) {
-				exit_t* ex2 = exit_iter.x;
+	vector_free(&frames);
+	vector_free(&ops);
+	vector_free(&vals);
 
-				if (ex2->defer_i!=deferred_iter.i+1) continue;
+	return ok;
+}
 
-				if (!label_str) {
-					item_t* label = item_push(proc, item_label, proc->iter.x, proc->iter.x);
-					item_t* label_name = item_push(proc, item_name, label, label);
+//ith child, not counting directives and macro bookkeeping
+item_t* item_nth(item_t* item, unsigned i) {
+	vector_iterator body_iter = vector_iterate(&item->body);
+	while (vector_next(&body_iter)) {
+		item_t* x = *(item_t**)body_iter.x;
+		if (!item_special(x) && i--==0) return x;
+	}
 
-					label_str = heapstr("defer%u", deferred_iter.i);
-					while (map_insertcpy_noexist(&proc->name_label, &label_str, &label).exists)
-						label_str = straffix(label_str, "_");
+	return NULL;
+}
 
-					label_name->str=heapcpystr(label_str);
-				}
+//whether the condition at i in the body of an if, else if, while or do while is constant, and if so its truth
+//-1 if not constant, or if it is followed by another expression after a comma
+int cond_const(parser_t* parser, item_t* item, unsigned i) {
+	item_t* cond = item_nth(item, i);
+	if (!cond || cond->ty!=item_expr || cond->gen) return -1;
 
-				unsigned ex_i = vector_search(&ex2->item->parent->body, &ex2->item);
+	token_t* next = vector_get(&parser->tokens, cond->span.end+1);
+	if (!next || next->ty!=tok_rparen) return -1;
 
-				item_t* goto_item = item_new(proc, item_goto, ex2->item, ex2->item->parent);
-				item_t* goto_label_name = item_push(proc, item_name, goto_item, goto_item);
-				goto_label_name->str=heapcpystr(label_str);
+	long long v;
+	if (!expr_const(parser, cond, &v)) return -1;
+	return v!=0;
+}
 
-				vector_setcpy(&ex2->item->parent->body, ex_i, &goto_item);
+//whether item is never reached since a constant condition before it in its parent is false
+//only the branches themselves, everything within them is dead as well
+//a branch with a label in it can still be jumped into, so it is never dead
+int item_dead(parser_t* parser, item_t* item) {
+	item_t* parent = item->parent;
+	if (!parent || item->gen || item->contains & contains_label) return 0;
+
+	switch (parent->ty) {
+		case item_if: {
+			if (item==item_nth(parent, 0)) return 0;
+			if (item==item_nth(parent, 1)) return cond_const(parser, parent, 0)==0;
+
+			//else ifs and else are skipped by a true condition before them
+			if (cond_const(parser, parent, 0)==1) return 1;
+
+			vector_iterator body_iter = vector_iterate(&parent->body);
+			while (vector_next(&body_iter)) {
+				item_t* x = *(item_t**)body_iter.x;
+				if (x==item) break;
+				if (x->ty==item_elseif && cond_const(parser, x, 0)==1) return 1;
 			}
 
-			vector_pushcpy(&proc->iter.x->body, &defer);
+			return 0;
 		}
+		case item_elseif:
+		case item_while: return item==item_nth(parent, 1) && cond_const(parser, parent, 0)==0;
+		default: return 0;
+	}
+}
 
-		if (ex) {
-			scope_item = proc->iter.x;
-			while (scope_item && scope_item!=ex->exit_scope->parent) {
-				deferred_iter = vector_iterate_end(&scope_item->scope->deferred);
-				while (vector_prev(&deferred_iter)) {
-					item_t* deferred = *(item_t**)deferred_iter.x;
-					vector_pushcpy(&proc->iter.x->body, &deferred);
-				}
+//token an item is attributed to in line directives
+unsigned item_tok(item_t* item) {
+	return item->gen ? item->gen_tok : item->span.start;
+}
 
-				scope_item=scope_get(scope_item);
-			}
+item_t* item_new(process_t* proc, item_ty ty, item_t* inherit, item_t* parent) {
+	item_t* item = heapcpy(sizeof(item_t), &(item_t){.ty=ty,
+			.if_i=inherit ? inherit->if_i : -1,
+			.if_stack=inherit ? inherit->if_stack : -1,
+			.body=vector_new(sizeof(item_t*)), .gen=1, .str=NULL, .parent=parent,
+			.gen_tok=inherit ? item_tok(inherit) : -1});
 
-			vector_pushcpy(&proc->iter.x->body, &ex->item);
-		}
-	} else {
-		if (!scope_exits_early(proc, proc->iter.x)) {
-			vector_iterator deferred_iter = vector_iterate_end(&sc->deferred);
-			while (vector_prev(&deferred_iter)) {
-				item_t* defer = *(item_t**)deferred_iter.x;
-				vector_pushcpy(&proc->iter.x->body, &defer);
-			}
-		}
+	vector_pushcpy(&proc->parser->gen_pool, &item);
 
-		exit_iter = vector_iterate(&sc->exits);
-		while (vector_next(&exit_iter)) {
-			ex = exit_iter.x;
-			//yes we have to do this every time considering all the varying modifications we are performing before each exit
-			unsigned ex_i = vector_search(&ex->item->parent->body, &ex->item);
-
-			scope_item = proc->iter.x;
-			while (scope_item && scope_item!=ex->exit_scope->parent) {
-				vector_iterator deferred_iter = vector_iterate_end(&scope_item->scope->deferred);
-				if (scope_item==proc->iter.x) deferred_iter.i = ex->defer_i;
-
-				while (vector_prev(&deferred_iter)) {
-					item_t* deferred = *(item_t**)deferred_iter.x;
-					vector_insertcpy(&ex->item->parent->body, ex_i, &deferred);
-				}
+	return item;
+}
 
-				scope_item=scope_get(scope_item);
-			}
-		}
+item_t* item_push(process_t* proc, item_ty ty, item_t* parent, item_t* inherit) {
+	item_t* item = item_new(proc, ty, inherit, parent);
+	vector_pushcpy(&parent->body, &item);
+	return item;
+}
+
+//generated code printed verbatim, takes str
+item_t* item_raw(process_t* proc, item_t* parent, item_t* inherit, char* str) {
+	item_t* item = item_new(proc, item_name, inherit, parent);
+	item->str = str;
+	return item;
+}
+
+//new label, named after prefix (taken) and unique in the function
+item_t* label_new(process_t* proc, item_t* parent, char* prefix) {
+	item_t* label = item_new(proc, item_label, parent, parent);
+	item_t* label_name = item_push(proc, item_name, label, label);
+
+	char* label_str = prefix;
+	while (sym_insert(&proc->syms, label_str, label))
+		label_str = straffix(label_str, "_");
+
+	label_name->str = heapcpystr(label_str);
+	return label;
+}
+
+item_t* goto_new(process_t* proc, item_t* label, item_t* inherit) {
+	item_t* goto_item = item_new(proc, item_goto, inherit, inherit->parent);
+	item_t* goto_label_name = item_push(proc, item_name, goto_item, goto_item);
+	goto_label_name->str = heapcpystr((*(item_t**)vector_get(&label->body, 0))->str);
+
+	return goto_item;
+}
+
+//attribute a generated item and the generated items under it to the line of tok
+void item_attribute(item_t* item, unsigned tok) {
+	if (!item->gen) return;
+	item->gen_tok = tok;
+
+	vector_iterator iter = vector_iterate(&item->body);
+	while (vector_next(&iter)) {
+		item_attribute(*(item_t**)iter.x, tok);
 	}
 }
 
-void process(process_t* proc) {
-	item_t* current=item_iter_scope(&proc->iter);
-	while (item_next(&proc->iter)) {
-		switch (proc->iter.x->ty) {
-			case item_block:
-			case item_func: {
-				process_scope(proc);
-				break;
-			}
+//size in tokens, for lowering costs
+unsigned item_cost(item_t* item) {
+	if (item->gen || item->span.end<item->span.start) return 1;
+	return item->span.end-item->span.start+1;
+}
 
-			case item_switch: {
-				item_descend(&proc->iter);
-				item_get(&proc->iter, 1);
-				process_scope(proc);
-				item_ascend(&proc->iter);
-				break;
-			}
+void splice(process_t* proc, item_t* parent, unsigned i, item_t* item, int replace) {
+	vector_pushcpy(&proc->splices, &(splice_t){.parent=parent, .i=i, .item=item,
+			.replace=replace, .order=proc->splices.length});
+}
 
-			case item_defer: {
-				item_descend(&proc->iter);
-				item_get(&proc->iter, 0);
-				vector_pushcpy(&current->scope->deferred, &proc->iter.x);
-				item_ascend(&proc->iter);
+//like splice, but before anything else spliced at i, which may use what item declares
+void splice_decl(process_t* proc, item_t* parent, unsigned i, item_t* item) {
+	vector_pushcpy(&proc->splices, &(splice_t){.parent=parent, .i=i, .item=item,
+			.replace=0, .decl=1, .order=proc->splices.length});
+}
 
-				item_remove(&proc->iter);
+int splice_cmp(const void* a, const void* b) {
+	const splice_t* s1=a, *s2=b;
+	if (s1->parent!=s2->parent) return s1->parent<s2->parent ? -1 : 1;
+	if (s1->i!=s2->i) return s1->i<s2->i ? -1 : 1;
+	if (s1->decl!=s2->decl) return s2->decl-s1->decl;
+	if (s1->replace!=s2->replace) return s1->replace-s2->replace;
+	return s1->order<s2->order ? -1 : 1;
+}
 
-				break;
-			}
+//rebuilds every spliced body once, instead of shifting it for each insertion
+void splice_apply(process_t* proc) {
+	if (proc->splices.length==0) return;
+	qsort(vector_get(&proc->splices, 0), proc->splices.length, sizeof(splice_t), splice_cmp);
 
-			case item_ret: {
-				item_t* scope_item = current;
-				while (!scope_item->scope->ret) scope_item=scope_get(scope_item);
+	vector_iterator splice_iter = vector_iterate(&proc->splices);
+	vector_next(&splice_iter);
 
-				vector_pushcpy(&current->scope->exits, &(exit_t){.item=proc->iter.x,
-						.defer_i=current->scope->deferred.length, .exit_scope=scope_item});
-				break;
-			}
+	while (splice_iter.x) {
+		item_t* parent = ((splice_t*)splice_iter.x)->parent;
+		vector_t body = vector_new(sizeof(item_t*));
 
-			case item_break: {
-				item_t* scope_item = current;
-				while (!scope_item->scope->br) {
-					scope_item=scope_get(scope_item);
-					if (!scope_item) {
-						parser_error(proc->parser, proc->iter.x->span, "nothing to break to", 1);
-						break;
-					}
-				}
+		for (unsigned i=0; i<=parent->body.length; i++) {
+			int replaced=0;
 
-				vector_pushcpy(&current->scope->exits, &(exit_t){.item=proc->iter.x,
-						.defer_i=current->scope->deferred.length, .exit_scope=scope_item});
-				break;
+			for (splice_t* s=splice_iter.x; s && s->parent==parent && s->i==i; s=splice_iter.x) {
+				vector_pushcpy(&body, &s->item);
+				if (s->replace) replaced=1;
+
+				if (!vector_next(&splice_iter)) splice_iter.x=NULL;
 			}
 
-			case item_goto: {
-				item_descend(&proc->iter);
-				item_t* label = *(item_t**)map_find(&proc->name_label, &(char*){item_str(proc->parser, item_get(&proc->iter, 0))});
-				item_ascend(&proc->iter);
+			if (!replaced && i<parent->body.length)
+				vector_pushcpy(&body, vector_get(&parent->body, i));
+		}
 
-				if (!label) {
-					parser_error(proc->parser, proc->iter.x->span, "label out of scope", 1);
-					break;
-				}
+		vector_free(&parent->body);
+		parent->body = body;
+	}
 
-				//doesnt actually exit
-				item_t* label_scope = scope_get(label);
-				if (current==label_scope || item_child(current, label_scope)) break;
+	vector_clear(&proc->splices);
+}
 
-				vector_pushcpy(&current->scope->exits, &(exit_t){.item=proc->iter.x,
-						.defer_i=current->scope->deferred.length, .exit_scope=label_scope});
-				break;
-			}
+//puts items in place of item (at i in its parent), in a new block unless it is already in one
+void item_replace(process_t* proc, item_t* item, unsigned i, vector_t* items) {
+	item_t* parent = item->parent;
 
-			default:;
+	if (parent->ty!=item_block) {
+		item_t* block = item_new(proc, item_block, item, parent);
+		vector_iterator item_iter = vector_iterate(items);
+		while (vector_next(&item_iter)) {
+			vector_pushcpy(&block->body, item_iter.x);
 		}
 
-		if (proc->parser->stop) return;
+		splice(proc, parent, i, block, 1);
+		return;
+	}
+
+	vector_iterator item_iter = vector_iterate(items);
+	while (vector_next(&item_iter)) {
+		splice(proc, parent, i, *(item_t**)item_iter.x, item_iter.i==items->length-1);
 	}
 }
 
-process_t process_new(parser_t* parser)	{
-	process_t proc = {.name_label=map_new(), .parser=parser,
-			.iter=item_iterate(parser), .name_item=map_new(), .names=vector_new(sizeof(char*)),
-			.objs=vector_new(sizeof(void*))};
+//outermost scope from current that is still in loop, which breaks and continues leave
+item_t* loop_scope(item_t* loop, item_t* current) {
+	item_t* scope_item = current;
+	for (item_t* up=scope_get(scope_item); up && item_child(loop, up); up=scope_get(up))
+		scope_item = up;
+
+	return scope_item;
+}
 
-	map_configure_string_key(&proc.name_label, sizeof(item_t*));
-	map_configure_string_key(&proc.name_item, sizeof(item_t*));
+//whether scope_item is the block of a loop, rather than one in a body that isnt a block
+int loop_body(item_t* scope_item) {
+	item_t* parent = scope_item->parent;
+	return parent && (parent->ty==item_while || parent->ty==item_for || parent->ty==item_dowhile);
+}
 
-	proc.name_label.free = free_string;
-	proc.name_item.free = free_string;
+//scope where running deferred statements stops for ex, exclusive
+item_t* exit_stop(exit_t* ex) {
+	//the loop body's own deferred statements are shared at its end
+	if (ex->item->ty==item_continue && loop_body(ex->exit_scope)) return ex->exit_scope;
+	if (ex->item->ty!=item_goto) return scope_get(ex->exit_scope);
 
-	tag_items(&proc);
-	item_restart(&proc.iter);
-	process(&proc);
+	//gotos only leave scopes that do not contain the label
+	item_t* scope_item = scope_get(ex->item);
+	while (scope_item && scope_item!=ex->exit_scope && !item_child(scope_item, ex->exit_scope))
+		scope_item = scope_get(scope_item);
 
-	return proc;
+	return scope_item;
 }
 
-void process_free(process_t* proc) {
-	map_free(&proc->name_label);
-	map_free(&proc->name_item);
-	vector_free_strings(&proc->names);
+//deferred statements that run before ex from scope from onwards (from_i of from's), innermost first
+void exit_cleanups(exit_t* ex, item_t* from, unsigned from_i, vector_t* out) {
+	vector_clear(out);
+	item_t* stop = exit_stop(ex);
 
-	vector_iterator obj_iter = vector_iterate(&proc->objs);
-	while (vector_next(&obj_iter)) {
-		drop(*(void**)obj_iter.x);
+	for (item_t* scope_item=from; scope_item && scope_item!=stop; scope_item=scope_get(scope_item)) {
+		vector_iterator deferred_iter = vector_iterate_end(&scope_item->scope->deferred);
+		if (scope_item==from && from_i<deferred_iter.i) deferred_iter.i = from_i;
+
+		while (vector_prev(&deferred_iter)) {
+			if (ex->err!=1 && *(char*)vector_get(&scope_item->scope->deferred_err, deferred_iter.i)) continue;
+			vector_pushcpy(out, deferred_iter.x);
+		}
 	}
+}
 
-	vector_free(&proc->objs);
+//whether func returns a pointer
+int ret_ptr(item_t* func) {
+	item_t* ty = item_nth(func, 0);
+	item_t* uber = item_nth(ty, ty->body.length-1);
+	return uber->ty==item_uber && uber->body.length>0;
+}
+
+//1 if ret is an error exit, which errdefers run on, 0 if not and -1 if it cant be told
+//marked returns are what they say, otherwise
+//nonzero constants, negations (-EINVAL) and NULL are errors, 0 and no value are not
+//other values are results when func returns a pointer, since NULL is its error then
+int ret_err(parser_t* parser, item_t* func, item_t* ret) {
+	if (ret->mark) return ret->mark==1;
+
+	item_t* value = item_nth(ret, 0);
+	if (!value) return 0;
+	if (value->ty!=item_expr || item_nth(ret, 1)) return -1;
+
+	long long v;
+	if (expr_const(parser, value, &v)) return v!=0;
+
+	item_t* first = item_nth(value, 0);
+	if (!first) return -1;
+
+	char* s = item_str(parser, first);
+	int err = first->ty==item_op ? cop_parse(s, 1)==cop_neg && item_nth(value, 2)==NULL
+		: first->ty==item_name && strcmp(s, "NULL")==0 && item_nth(value, 1)==NULL;
+	drop(s);
+
+	if (err) return 1;
+	return ret_ptr(func) ? 0 : -1;
+}
+
+//whether ex passes an errdefer, from scope from onwards (from_i of from's) like exit_cleanups
+int exit_errdefers(exit_t* ex, item_t* from, unsigned from_i) {
+	item_t* stop = exit_stop(ex);
+
+	for (item_t* scope_item=from; scope_item && scope_item!=stop; scope_item=scope_get(scope_item)) {
+		unsigned len = scope_item->scope->deferred_err.length;
+		if (scope_item==from && from_i<len) len = from_i;
+
+		for (unsigned i=0; i<len; i++) {
+			if (*(char*)vector_get(&scope_item->scope->deferred_err, i)) return 1;
+		}
+	}
+
+	return 0;
+}
+
+//type of func's return slot, NULL for void
+char* ret_slot_ty(parser_t* parser, item_t* func) {
+	item_t* ty = item_nth(func, 0);
+	item_t* base = item_nth(ty, 0);
+	int ptr = ret_ptr(func);
+
+	//top level const would make the slot unassignable
+	if (!ptr && base->ty==item_typemod) base = item_nth(ty, 1);
+
+	char* str = item_str(parser, &(item_t){.span={.start=base->span.start, .end=ty->span.end}});
+	if (!ptr && strcmp(str, "void")==0) {
+		drop(str);
+		return NULL;
+	}
+
+	return str;
+}
+
+//the value of a return is evaluated into the function's slot before cleanups run, which may free what it reads
+//ex->item becomes a return of the slot, which every such exit shares
+void ret_slot(process_t* proc, exit_t* ex) {
+	item_t* ret = ex->item;
+	item_t* value = item_nth(ret, 0);
+	if (!value || item_nth(ret, 1)) return;
+
+	char* ty = ret_slot_ty(proc->parser, ex->exit_scope->parent);
+	if (!ty) return;
+	drop(ty);
+
+	ex->value = item_new(proc, item_expr, ret, ret->parent);
+	vector_pushcpy(&ex->value->body, &(item_t*){item_raw(proc, ex->value, ret, heapcpystr("__defer_ret"))});
+	vector_pushcpy(&ex->value->body, &(item_t*){item_raw(proc, ex->value, ret, heapcpystr(" = "))});
+
+	//along with the call of a macro the value starts in, which stands in for its expansion
+	vector_iterator body_iter = vector_iterate(&ret->body);
+	while (vector_next(&body_iter)) {
+		item_t* x = *(item_t**)body_iter.x;
+		vector_pushcpy(&ex->value->body, &x);
+		x->parent = ex->value;
+	}
+
+	ex->item = item_new(proc, item_ret, ret, ret->parent);
+	vector_pushcpy(&ex->item->body, &(item_t*){item_raw(proc, ex->item, ret, heapcpystr("__defer_ret"))});
+
+	proc->fn_ret=1;
+}
+
+//if or else if that ex is the early exit of, taken only on errors usually
+//NULL unless ex is a return or goto directly in the branch's body
+item_t* exit_branch(exit_t* ex) {
+	if (ex->item->ty!=item_ret && ex->item->ty!=item_goto) return NULL;
+
+	//by position, ex->item may be a replacement not in the body yet
+	item_t* branch = ex->item->parent;
+	int body = ex->body_i==1;
+	if (branch->ty==item_block) {
+		body = item_nth(branch->parent, 1)==branch;
+		branch = branch->parent;
+	}
+
+	if (!branch || (branch->ty!=item_if && branch->ty!=item_elseif) || !body) return NULL;
+
+	return branch;
+}
+
+//wraps the condition of branch in __builtin_expect(!!(cond), 0)
+void branch_unlikely(process_t* proc, item_t* branch) {
+	item_t** cond_ref = vector_get(&branch->body, 0);
+	item_t* cond = *cond_ref;
+
+	//hinted already, or known either way
+	if (cond->gen || cond_const(proc->parser, branch, 0)!=-1) return;
+
+	item_t* hint = item_new(proc, item_fncall, cond, branch);
+	vector_pushcpy(&hint->body, &(item_t*){item_raw(proc, hint, cond, heapcpystr("__builtin_expect"))});
+
+	item_t* truth = item_push(proc, item_expr, hint, cond);
+	item_push(proc, item_op, truth, cond)->str = heapcpystr("!!");
+	vector_pushcpy(&truth->body, &cond);
+	cond->parent = truth;
+
+	vector_pushcpy(&hint->body, &(item_t*){item_raw(proc, hint, cond, heapcpystr("0"))});
+	*cond_ref = hint;
+}
+
+//declares the return slot at the top of the function's block once it is lowered, which every return is then
+void ret_slot_decl(process_t* proc) {
+	item_t* scope_item = proc->iter.x;
+	if (!scope_item->scope->ret || !proc->fn_ret) return;
+
+	char* ty = ret_slot_ty(proc->parser, scope_item->parent);
+	splice_decl(proc, scope_item, 0, item_raw(proc, scope_item, scope_item, heapstr("%s __defer_ret;", ty)));
+	drop(ty);
+
+	proc->fn_ret=0;
+}
+
+//whether a break (or continue, for do while (0)) in loop leaves it, rather than a loop or switch nested in it
+int item_breaks(item_t* loop) {
+	if (!(loop->contains & contains_exit)) return 0;
+
+	vector_t stack = vector_new(sizeof(item_t*));
+	vector_stockcpy(&stack, loop->body.length, vector_get(&loop->body, 0));
+
+	int breaks=0;
+	while (!breaks && stack.length>0) {
+		item_t* x = *(item_t**)vector_get(&stack, stack.length-1);
+		vector_pop(&stack);
+
+		if (x->ty==item_break || x->ty==item_continue) breaks=1;
+		else if (x->ty!=item_while && x->ty!=item_for && x->ty!=item_dowhile && x->ty!=item_switch
+				&& (x->contains & contains_exit) && x->body.length)
+			vector_stockcpy(&stack, x->body.length, vector_get(&x->body, 0));
+	}
+
+	vector_free(&stack);
+	return breaks;
+}
+
+//conservative; 0 only when every path to the end of item leaves it
+int item_falls_through(process_t* proc, item_t* item) {
+	vector_clear(&proc->walk);
+	vector_pushcpy(&proc->walk, &item);
+
+	while (proc->walk.length>0) {
+		item_t* x = *(item_t**)vector_get(&proc->walk, proc->walk.length-1);
+		vector_pop(&proc->walk);
+
+		switch (x->ty) {
+			case item_ret:
+			case item_break:
+			case item_continue:
+			case item_goto: break;
+			case item_block: {
+				item_t* last=NULL;
+
+				vector_iterator body_iter = vector_iterate_end(&x->body);
+				while (vector_prev(&body_iter)) {
+					last = *(item_t**)body_iter.x;
+					if (!item_special(last)) break;
+					last = NULL;
+				}
+
+				if (!last) return 1;
+				vector_pushcpy(&proc->walk, &last);
+				break;
+			}
+			case item_if: {
+				//only the then branch runs, unless a goto can reach the others
+				if (cond_const(proc->parser, x, 0)==1 && !(x->contains & contains_label)) {
+					item_t* then = item_nth(x, 1);
+					vector_pushcpy(&proc->walk, &then);
+					break;
+				}
+
+				item_t* last = *(item_t**)vector_get(&x->body, x->body.length-1);
+				if (last->ty!=item_else) return 1;
+
+				//condition, then branch, else if branches and else
+				vector_iterator body_iter = vector_iterate(&x->body);
+				vector_next(&body_iter);
+				while (vector_next(&body_iter)) {
+					item_t* branch = *(item_t**)body_iter.x;
+					if (branch->ty==item_elseif) branch = *(item_t**)vector_get(&branch->body, 1);
+					else if (branch->ty==item_else) branch = *(item_t**)vector_get(&branch->body, 0);
+
+					vector_pushcpy(&proc->walk, &branch);
+				}
+
+				break;
+			}
+			//do { } while (0) runs once, straight through unless something breaks out of it
+			case item_dowhile: {
+				if (cond_const(proc->parser, x, 1)!=0 || item_breaks(x)) return 1;
+
+				item_t* body = item_nth(x, 0);
+				vector_pushcpy(&proc->walk, &body);
+				break;
+			}
+			default: return 1;
+		}
+	}
+
+	return 0;
+}
+
+//counter increment for --count-exits, attributed to the line of tok
+item_t* exit_counter(process_t* proc, item_t* parent, item_t* inherit, unsigned tok, char* kind) {
+	item_t* item = item_raw(proc, parent, inherit, NULL);
+	vector_pushcpy(&proc->counters, &(exit_counter_t){.item=item, .tok=tok, .kind=kind});
+	return item;
+}
+
+char* exit_kind(exit_t* ex) {
+	return ex->item->ty==item_ret ? "return" : ex->item->ty==item_break ? "break"
+			: ex->item->ty==item_continue ? "continue" : "goto";
+}
+
+//token ex is reported at
+unsigned exit_tok(exit_t* ex) {
+	//returns through the slot are generated, the value is where they were
+	item_t* at = ex->value ? item_nth(ex->value, 2) : ex->item;
+	return at->span.start;
+}
+
+//counts ex before anything it is lowered to
+void exit_count(process_t* proc, exit_t* ex, vector_t* items) {
+	if (!proc->opts.count_exits) return;
+	vector_insertcpy(items, 0, &(item_t*){exit_counter(proc, ex->item->parent, ex->item, exit_tok(ex), exit_kind(ex))});
+}
+
+//defer a deferred statement was taken out of, NULL for other items
+item_t* item_defer_of(item_t* item) {
+	if (!item->parent || (item->parent->ty!=item_defer && item->parent->ty!=item_errdefer)) return NULL;
+	return item->parent;
+}
+
+void bloat_place(process_t* proc, item_t* deferred, char copy, unsigned tok, char* kind) {
+	if (!proc->opts.bloat) return;
+	vector_pushcpy(&proc->bloat, &(bloat_t){.defer=deferred->parent, .deferred=deferred, .copy=copy, .tok=tok, .kind=kind});
+}
+
+//deferred statements in items are copies run by ex, or by every exit of its kind in the scope being lowered
+void bloat_exit(process_t* proc, vector_t* items, exit_t* ex, int kind) {
+	if (!proc->opts.bloat) return;
+
+	vector_iterator item_iter = vector_iterate(items);
+	while (vector_next(&item_iter)) {
+		item_t* deferred = *(item_t**)item_iter.x;
+		if (!item_defer_of(deferred)) continue;
+
+		if (!kind) {
+			bloat_place(proc, deferred, 1, exit_tok(ex), exit_kind(ex));
+			continue;
+		}
+
+		char copy=1;
+		vector_iterator exit_iter = vector_iterate(&proc->iter.x->scope->exits);
+		while (vector_next(&exit_iter)) {
+			exit_t* kind_ex = exit_iter.x;
+			if (kind_ex->kind!=ex->kind) continue;
+
+			bloat_place(proc, deferred, copy, exit_tok(kind_ex), exit_kind(kind_ex));
+			copy=0;
+		}
+	}
+}
+
+//cleanups of the ladder run for every exit jumping in above them and for falling through
+void bloat_ladder(process_t* proc, item_t* deferred, unsigned deferred_i, int falls) {
+	if (!proc->opts.bloat) return;
+	item_t* scope_item = proc->iter.x;
+
+	char copy=1;
+	if (falls) {
+		bloat_place(proc, deferred, copy, scope_item->span.end, "end");
+		copy=0;
+	}
+
+	vector_iterator exit_iter = vector_iterate(&scope_item->scope->exits);
+	while (vector_next(&exit_iter)) {
+		exit_t* ex = exit_iter.x;
+		if (ex->defer_i<=deferred_i) continue;
+
+		bloat_place(proc, deferred, copy, exit_tok(ex), exit_kind(ex));
+		copy=0;
+	}
+}
+
+void scope_lower_dup(process_t* proc, int falls) {
+	item_t* scope_item = proc->iter.x;
+	scope_t* sc = scope_item->scope;
+
+	if (falls) {
+		vector_iterator deferred_iter = vector_iterate_end(&sc->deferred);
+		while (vector_prev(&deferred_iter)) {
+			if (*(char*)vector_get(&sc->deferred_err, deferred_iter.i)) continue;
+			vector_pushcpy(&scope_item->body, deferred_iter.x);
+			bloat_place(proc, *(item_t**)deferred_iter.x, 1, scope_item->span.end, "end");
+		}
+	}
+
+	vector_t items = vector_new(sizeof(item_t*));
+
+	vector_iterator exit_iter = vector_iterate(&sc->exits);
+	while (vector_next(&exit_iter)) {
+		exit_t* ex = exit_iter.x;
+
+		exit_cleanups(ex, scope_item, ex->defer_i, &items);
+		if (items.length==0) continue;
+
+		bloat_exit(proc, &items, ex, 0);
+
+		if (ex->value) vector_insertcpy(&items, 0, &ex->value);
+		vector_pushcpy(&items, &ex->item);
+		exit_count(proc, ex, &items);
+
+		//the compiler moves what follows the label out of the hot path
+		if (proc->opts.cold && exit_branch(ex)) {
+			vector_insertcpy(&items, 0, &(item_t*){item_raw(proc, ex->item->parent, ex->item, heapcpystr("__attribute__((cold, unused));"))});
+			vector_insertcpy(&items, 0, &(item_t*){label_new(proc, ex->item->parent, heapstr("defer_cold%u", proc->fn_colds++))});
+		}
+
+		item_replace(proc, ex->item, ex->body_i, &items);
+	}
+
+	vector_free(&items);
+}
+
+//deferred statements are placed once at the end of the scope under labels, exits jump to theirs
+//each kind of exit is dispatched after the last, with the remaining cleanups of outer scopes
+void scope_lower_ladder(process_t* proc, vector_t* kinds, int falls) {
+	item_t* scope_item = proc->iter.x;
+	scope_t* sc = scope_item->scope;
+
+	//an exit ending the body after every deferred statement runs straight into the ladder
+	exit_t* last_ex = sc->exits.length ? vector_get(&sc->exits, sc->exits.length-1) : NULL;
+	if (last_ex && (last_ex->item->parent!=scope_item || last_ex->body_i!=scope_item->body.length-1
+			|| last_ex->defer_i!=sc->deferred.length)) last_ex=NULL;
+
+	//which kind jumped here, when it can not be told otherwise
+	int var = kinds->length>1 || (kinds->length==1 && falls);
+	if (var) {
+		splice_decl(proc, scope_item, 0, item_raw(proc, scope_item, scope_item, heapcpystr("int __defer_exit;")));
+
+		if (falls) {
+			item_t* fall = item_raw(proc, scope_item, scope_item, heapcpystr("__defer_exit = 0;"));
+			item_attribute(fall, scope_item->span.end);
+			vector_pushcpy(&scope_item->body, &fall);
+		}
+	}
+
+	item_t** labels = heap(sizeof(item_t*)*(sc->deferred.length+1));
+	memset(labels, 0, sizeof(item_t*)*(sc->deferred.length+1));
+
+	vector_iterator exit_iter = vector_iterate(&sc->exits);
+	while (vector_next(&exit_iter)) {
+		exit_t* ex = exit_iter.x;
+		if (ex!=last_ex && !labels[ex->defer_i])
+			labels[ex->defer_i] = label_new(proc, scope_item, heapstr("defer%u", proc->fn_ladders++));
+	}
+
+	item_t* last=NULL;
+	for (unsigned i=sc->deferred.length+1; i-->0;) {
+		//labels go with the cleanup they start
+		if (labels[i]) {
+			item_attribute(labels[i], i>0 ? item_tok(*(item_t**)vector_get(&sc->deferred, i-1)) : scope_item->span.end);
+			vector_pushcpy(&scope_item->body, &labels[i]);
+		}
+
+		if (i>0) {
+			vector_pushcpy(&scope_item->body, vector_get(&sc->deferred, i-1));
+			bloat_ladder(proc, *(item_t**)vector_get(&sc->deferred, i-1), i-1, falls);
+		}
+
+		last = *(item_t**)vector_get(&scope_item->body, scope_item->body.length-1);
+	}
+
+	vector_t items = vector_new(sizeof(item_t*));
+
+	vector_iterator kind_iter = vector_iterate(kinds);
+	while (vector_next(&kind_iter)) {
+		exit_t* ex = *(exit_t**)kind_iter.x;
+		item_t* body = scope_item;
+
+		if (var) {
+			item_t* cond = item_push(proc, item_if, scope_item, scope_item);
+			vector_pushcpy(&cond->body, &(item_t*){item_raw(proc, cond, scope_item, heapstr("__defer_exit == %u", ex->kind))});
+			body = item_push(proc, item_block, cond, scope_item);
+			item_attribute(cond, item_tok(ex->item));
+		}
+
+		exit_cleanups(ex, scope_get(scope_item), -1, &items);
+		bloat_exit(proc, &items, ex, 1);
+		vector_pushcpy(&items, &ex->item);
+
+		vector_iterator item_iter = vector_iterate(&items);
+		while (vector_next(&item_iter)) {
+			vector_pushcpy(&body->body, item_iter.x);
+		}
+
+		last = *(item_t**)vector_get(&scope_item->body, scope_item->body.length-1);
+	}
+
+	//labels need a statement
+	if (last && last->ty==item_label)
+		vector_pushcpy(&scope_item->body, &(item_t*){item_raw(proc, scope_item, scope_item, heapcpystr(";"))});
+
+	exit_iter = vector_iterate(&sc->exits);
+	while (vector_next(&exit_iter)) {
+		exit_t* ex = exit_iter.x;
+
+		vector_clear(&items);
+		if (ex->value) vector_pushcpy(&items, &ex->value);
+
+		if (var) {
+			item_t* set = item_raw(proc, ex->item->parent, ex->item, heapstr("__defer_exit = %u;", ex->kind));
+			vector_pushcpy(&items, &set);
+		}
+
+		if (ex!=last_ex) vector_pushcpy(&items, &(item_t*){goto_new(proc, labels[ex->defer_i], ex->item)});
+		exit_count(proc, ex, &items);
+
+		//the exit itself moved into the ladder, nothing is left in its place
+		if (items.length==0) vector_pushcpy(&items, &(item_t*){item_raw(proc, ex->item->parent, ex->item, heapcpystr(""))});
+		item_replace(proc, ex->item, ex->body_i, &items);
+	}
+
+	vector_free(&items);
+	drop(labels);
+}
+
+//continues run cleanups of scopes within the loop body, then jump into the loop body's at its end
+//past the deferred statements they had not reached yet
+void scope_lower_continues(process_t* proc) {
+	item_t* scope_item = proc->iter.x;
+	scope_t* sc = scope_item->scope;
+
+	vector_t items = vector_new(sizeof(item_t*));
+
+	vector_iterator exit_iter = vector_iterate(&sc->continues);
+	while (vector_next(&exit_iter)) {
+		exit_t* ex = exit_iter.x;
+		exit_cleanups(ex, scope_item, ex->defer_i, &items);
+		bloat_exit(proc, &items, ex, 0);
+
+		item_t* body = ex->exit_scope;
+		//outer scopes have run through to the block being left
+		unsigned run = !loop_body(body) ? 0 : body==scope_item ? ex->defer_i : body->scope->deferred.length;
+
+		if (run>0) {
+			while (body->scope->latches.length<=run) vector_pushcpy(&body->scope->latches, &(item_t*){NULL});
+
+			item_t** latch = vector_get(&body->scope->latches, run);
+			if (!*latch) *latch = label_new(proc, body, heapstr("continue%u", run));
+
+			vector_pushcpy(&items, &(item_t*){goto_new(proc, *latch, ex->item)});
+		} else if (items.length==0) {
+			continue;
+		} else {
+			vector_pushcpy(&items, &ex->item);
+		}
+
+		exit_count(proc, ex, &items);
+		item_replace(proc, ex->item, ex->body_i, &items);
+	}
+
+	vector_free(&items);
+}
+
+//deferred statements of a loop body at its end with the labels continues jump to, which falling through runs as well
+//more is set if lowering adds to the body after, so the cleanups dont fall into it
+void scope_lower_latch(process_t* proc, int more) {
+	item_t* scope_item = proc->iter.x;
+	scope_t* sc = scope_item->scope;
+
+	item_t* last=NULL;
+	for (unsigned i=sc->deferred.length+1; i-->0;) {
+		item_t** latch = vector_get(&sc->latches, i);
+		if (latch && *latch) {
+			item_attribute(*latch, i>0 ? item_tok(*(item_t**)vector_get(&sc->deferred, i-1)) : scope_item->span.end);
+			vector_pushcpy(&scope_item->body, latch);
+		}
+
+		//run by falling through and by continues, which are recorded where they are
+		if (i>0 && !*(char*)vector_get(&sc->deferred_err, i-1)) {
+			vector_pushcpy(&scope_item->body, vector_get(&sc->deferred, i-1));
+			bloat_place(proc, *(item_t**)vector_get(&sc->deferred, i-1), 1, scope_item->span.end, "end");
+		}
+
+		last = *(item_t**)vector_get(&scope_item->body, scope_item->body.length-1);
+	}
+
+	item_t* end=NULL;
+	if (more) {
+		end = item_raw(proc, scope_item, scope_item, heapcpystr("continue;"));
+	} else if (last && last->ty==item_label) {
+		end = item_raw(proc, scope_item, scope_item, heapcpystr(";"));
+	}
+
+	if (end) {
+		item_attribute(end, scope_item->span.end);
+		vector_pushcpy(&scope_item->body, &end);
+	}
+}
+
+//gcc: the defer at iter.x becomes a nested function, run when a guard declared after it goes out of scope
+//exits need no treatment, but unlike other lowerings jumping past a defer does not skip it
+void defer_cleanup(process_t* proc) {
+	item_t* defer = proc->iter.x;
+	scope_t* sc = item_iter_scope(&proc->iter)->scope;
+	item_t* deferred = *(item_t**)vector_get(&sc->deferred, sc->deferred.length-1);
+
+	unsigned defer_i = proc->fn_defers++;
+
+	vector_t items = vector_new(sizeof(item_t*));
+	vector_pushcpy(&items, &(item_t*){item_raw(proc, defer->parent, defer, heapstr("void __defer%u(int* __defer%u_guard)", defer_i, defer_i))});
+
+	bloat_place(proc, deferred, 1, item_iter_scope(&proc->iter)->span.end, "end");
+
+	item_t* body = item_new(proc, item_block, defer, defer->parent);
+	vector_pushcpy(&body->body, &deferred);
+	deferred->parent = body;
+	vector_pushcpy(&items, &body);
+
+	vector_pushcpy(&items, &(item_t*){item_raw(proc, defer->parent, defer,
+			heapstr("int __defer%u_guard __attribute__((cleanup(__defer%u)));", defer_i, defer_i))});
+
+	item_replace(proc, defer, item_index(&proc->iter), &items);
+	vector_free(&items);
+}
+
+//pass 1: instantaniate scope & labels
+//pass 2: populate scope
+
+void tag_items(process_t* proc) {
+	unsigned base = proc->iter.stack.length;
+	item_t* func=NULL;
+
+	while (1) {
+		if (!item_next(&proc->iter)) {
+			if (proc->iter.stack.length==base) break;
+
+			item_ascend(&proc->iter);
+			proc->iter.x->post = proc->ordinal;
+			continue;
+		}
+
+		item_t* parent = item_parent(&proc->iter);
+
+		proc->iter.x->pre = proc->iter.x->post = ++proc->ordinal;
+		proc->iter.x->scope_parent = !parent || parent->ty==item_block ? parent : parent->scope_parent;
+
+		//nothing below is looked up, descendants are left unnumbered
+		if (!proc->iter.x->contains) continue;
+
+		scope_t* sc = NULL;
+
+		switch (proc->iter.x->ty) {
+			case item_block: {
+				sc = scope_new(proc);
+
+				sc->ret = parent->ty==item_func;
+
+				break;
+			}
+
+			case item_func: {
+				sc = scope_new(proc);
+				func = proc->iter.x;
+				break;
+			}
+
+			case item_label: {
+				if (func) vector_pushcpy(&func->scope->labels, &proc->iter.x);
+				break;
+			}
+
+			default:;
+		}
+
+		if (proc->iter.x->body.length==0 && !sc) continue;
+		item_descend(&proc->iter);
+	}
+}
+
+//lowers the scope at iter.x once its body has been processed
+void process_scope(process_t* proc) {
+	item_t* scope_item = proc->iter.x;
+	scope_t* sc = scope_item->scope;
+
+	//defers were replaced where they are, nothing to do on exits
+	//enclosing bodies are still being walked, so wait for the whole function
+	if (proc->opts.lower==lower_cleanup) {
+		if (scope_item->ty==item_func) splice_apply(proc);
+		return;
+	}
+
+	int defers=0;
+	for (item_t* x=scope_item; x; x=scope_get(x)) {
+		if (x->scope->deferred.length) {
+			defers=1; break;
+		}
+	}
+
+	if (!defers) {
+		ret_slot_decl(proc);
+		splice_apply(proc);
+		return;
+	}
+
+	scope_lower_continues(proc);
+
+	vector_t cleanups = vector_new(sizeof(item_t*));
+
+	vector_iterator exit_iter = vector_iterate(&sc->exits);
+	while (vector_next(&exit_iter)) {
+		exit_t* ex = exit_iter.x;
+		if (ex->err==-1 && exit_errdefers(ex, scope_item, ex->defer_i))
+			parser_error(proc->parser, ex->item->span, "errdefer cant tell if this exit is an error, return a constant, a negation or NULL, or mark it with return errdefer/return defer", 1);
+
+		exit_cleanups(ex, scope_item, ex->defer_i, &cleanups);
+		if (cleanups.length==0) continue;
+
+		if (ex->item->ty==item_ret) ret_slot(proc, ex);
+
+		item_t* branch = proc->opts.cold ? exit_branch(ex) : NULL;
+		if (branch) branch_unlikely(proc, branch);
+	}
+
+	int falls = item_falls_through(proc, scope_item);
+
+	//exits that are the same can share their cleanups
+	//error and success returns of the slot look the same, but outer errdefers only run on one
+	//without errdefers to pass err stays 0, so all returns of the slot are one kind
+	vector_t kinds = vector_new(sizeof(exit_t*));
+
+	exit_iter = vector_iterate(&sc->exits);
+	while (vector_next(&exit_iter)) {
+		exit_t* ex = exit_iter.x;
+		ex->kind=0;
+
+		vector_iterator kind_iter = vector_iterate(&kinds);
+		while (vector_next(&kind_iter)) {
+			exit_t* kind_ex = *(exit_t**)kind_iter.x;
+			if (kind_ex->item->hash==ex->item->hash && exit_stop(kind_ex)==exit_stop(ex) && kind_ex->err==ex->err
+					&& item_eq(proc->parser, kind_ex->item, ex->item)) {
+				ex->kind = kind_ex->kind;
+				break;
+			}
+		}
+
+		if (!ex->kind) {
+			vector_pushcpy(&kinds, &ex);
+			ex->kind = kinds.length;
+		}
+	}
+
+	//tokens emitted for cleanups either way, plus jumps for the ladder
+	unsigned dup=0, ladder=0;
+
+	exit_iter = vector_iterate(&sc->exits);
+	while (vector_next(&exit_iter)) {
+		exit_t* ex = exit_iter.x;
+		exit_cleanups(ex, scope_item, ex->defer_i, &cleanups);
+
+		vector_iterator cleanup_iter = vector_iterate(&cleanups);
+		while (vector_next(&cleanup_iter)) {
+			dup += item_cost(*(item_t**)cleanup_iter.x);
+		}
+
+		ladder += proc->opts.jump_cost;
+	}
+
+	vector_iterator deferred_iter = vector_iterate(&sc->deferred);
+	while (vector_next(&deferred_iter)) {
+		ladder += item_cost(*(item_t**)deferred_iter.x);
+	}
+
+	vector_iterator kind_iter = vector_iterate(&kinds);
+	while (vector_next(&kind_iter)) {
+		exit_t* ex = *(exit_t**)kind_iter.x;
+		exit_cleanups(ex, scope_get(scope_item), -1, &cleanups);
+
+		vector_iterator cleanup_iter = vector_iterate(&cleanups);
+		while (vector_next(&cleanup_iter)) {
+			ladder += item_cost(*(item_t**)cleanup_iter.x);
+		}
+
+		ladder += item_cost(ex->item) + proc->opts.jump_cost;
+	}
+
+	vector_free(&cleanups);
+
+	//the ladder runs the same deferred statements for every exit, errdefers need their own copies
+	int errdefers = vector_search(&sc->deferred_err, &(char){1})!=-1;
+	//without deferred statements of its own there is no ladder to share, only outer cleanups
+	int use_ladder = sc->exits.length>0 && sc->deferred.length>0 && !errdefers && (proc->opts.lower==lower_ladder
+				|| (proc->opts.lower==lower_auto && ladder<dup));
+
+	//ahead of whatever falling through runs
+	if (falls && proc->opts.count_exits && sc->deferred.length>0)
+		vector_pushcpy(&scope_item->body, &(item_t*){exit_counter(proc, scope_item, scope_item, scope_item->span.end, "end")});
+
+	//falling through goes through the latch instead
+	if (sc->latches.length>0) {
+		scope_lower_latch(proc, use_ladder);
+		falls=0;
+	}
+
+	if (use_ladder) scope_lower_ladder(proc, &kinds, falls);
+	else scope_lower_dup(proc, falls);
+
+	vector_free(&kinds);
+	ret_slot_decl(proc);
+	splice_apply(proc);
+}
+
+void process(process_t* proc) {
+	unsigned base = proc->iter.stack.length;
+	vector_t outer = vector_new(sizeof(item_t*)); //current scope before each descent
+	unsigned dead_from = -1; //depth of the dead branch being walked, if any
+
+	item_t* current=item_iter_scope(&proc->iter);
+	while (1) {
+		if (!item_next(&proc->iter)) {
+			if (proc->iter.stack.length==base) break;
+
+			item_ascend(&proc->iter);
+			if (proc->iter.stack.length==dead_from) dead_from=-1;
+
+			if (proc->iter.x->ty==item_block || proc->iter.x->ty==item_func)
+				process_scope(proc);
+
+			current = *(item_t**)vector_get(&outer, outer.length-1);
+			vector_pop(&outer);
+
+			if (proc->parser->stop) break;
+			continue;
+		}
+
+		//exits that never run are left alone, defers are still taken out
+		int dead = dead_from!=-1 || item_dead(proc->parser, proc->iter.x);
+
+		switch (proc->iter.x->ty) {
+			case item_func: {
+				scope_labels(proc, proc->iter.x->scope);
+				proc->fn_defers=0;
+				proc->fn_colds=0;
+				proc->fn_ladders=0;
+				proc->fn_ret=0;
+			} //fallthrough
+			case item_block: {
+				if (!(proc->iter.x->contains & (contains_defer|contains_exit))) break;
+
+				vector_pushcpy(&outer, &current);
+				current=proc->iter.x;
+
+				if (dead && dead_from==-1) dead_from=proc->iter.stack.length;
+				item_descend(&proc->iter);
+				continue;
+			}
+
+			case item_defer:
+			case item_errdefer: {
+				char err = proc->iter.x->ty==item_errdefer;
+				vector_pushcpy(&current->scope->deferred_err, &err);
+
+				item_descend(&proc->iter);
+				item_get(&proc->iter, 0);
+				vector_pushcpy(&current->scope->deferred, &proc->iter.x);
+				bloat_place(proc, proc->iter.x, 0, -1, NULL);
+				item_ascend(&proc->iter);
+
+				if (proc->opts.lower==lower_cleanup) {
+					if (err) parser_error(proc->parser, proc->iter.x->span, "errdefer cant be lowered to cleanup attributes", 1);
+					else defer_cleanup(proc);
+
+					break;
+				}
+
+				item_remove(&proc->iter);
+
+				break;
+			}
+
+			case item_ret: {
+				if (dead) break;
+
+				item_t* scope_item = current;
+				while (!scope_item->scope->ret) scope_item=scope_get(scope_item);
+
+				exit_t ex = {.item=proc->iter.x, .defer_i=current->scope->deferred.length, .body_i=item_index(&proc->iter), .exit_scope=scope_item};
+				//without errdefers to pass, whether it is an error doesnt matter
+				if (exit_errdefers(&ex, current, ex.defer_i)) ex.err = ret_err(proc->parser, scope_item->parent, proc->iter.x);
+
+				vector_pushcpy(&current->scope->exits, &ex);
+				break;
+			}
+
+			case item_break: {
+				item_t* loop = proc->iter.x->parent;
+				while (loop && loop->ty!=item_while && loop->ty!=item_for
+						&& loop->ty!=item_dowhile && loop->ty!=item_switch) loop=loop->parent;
+
+				if (!loop) {
+					parser_error(proc->parser, proc->iter.x->span, "nothing to break to", 1);
+					break;
+				}
+
+				//loop is within the current scope
+				if (dead || !item_child(loop, current)) break;
+
+				vector_pushcpy(&current->scope->exits, &(exit_t){.item=proc->iter.x,
+						.defer_i=current->scope->deferred.length, .body_i=item_index(&proc->iter), .exit_scope=loop_scope(loop, current)});
+				break;
+			}
+
+			case item_continue: {
+				item_t* loop = proc->iter.x->parent;
+				while (loop && loop->ty!=item_while && loop->ty!=item_for && loop->ty!=item_dowhile) loop=loop->parent;
+
+				if (!loop) {
+					parser_error(proc->parser, proc->iter.x->span, "nothing to continue", 1);
+					break;
+				}
+
+				if (dead || !item_child(loop, current)) break;
+
+				vector_pushcpy(&current->scope->continues, &(exit_t){.item=proc->iter.x,
+						.defer_i=current->scope->deferred.length, .body_i=item_index(&proc->iter), .exit_scope=loop_scope(loop, current)});
+				break;
+			}
+
+			case item_goto: {
+				item_descend(&proc->iter);
+				char* name = item_str(proc->parser, item_get(&proc->iter, 0));
+				item_t* label = sym_find(&proc->syms, name);
+				item_ascend(&proc->iter);
+
+				drop(name);
+
+				if (!label) {
+					parser_error(proc->parser, proc->iter.x->span, "label out of scope", 1);
+					break;
+				}
+
+				//doesnt actually exit
+				item_t* label_scope = scope_get(label);
+				if (dead || current==label_scope || item_child(current, label_scope)) break;
+
+				//gotos may well be to error handling, there is no telling
+				vector_pushcpy(&current->scope->exits, &(exit_t){.item=proc->iter.x, .err=-1,
+						.defer_i=current->scope->deferred.length, .body_i=item_index(&proc->iter), .exit_scope=label_scope});
+				break;
+			}
+
+			case item_expr: break;
+
+			//exits can be nested in any other statement
+			default: {
+				if (!(proc->iter.x->contains & (contains_defer|contains_exit))) break;
+
+				vector_pushcpy(&outer, &current);
+
+				if (dead && dead_from==-1) dead_from=proc->iter.stack.length;
+				item_descend(&proc->iter);
+				continue;
+			}
+		}
+
+		if (proc->parser->stop) break;
+	}
+
+	vector_free(&outer);
+}
+
+//processes top-level items in [from, to), eg. after parser_edit
+//only those the parser saw a defer in are walked
+void process_items(process_t* proc, unsigned from, unsigned to) {
+	for (unsigned i=from; i<to && !proc->parser->stop; i++) {
+		item_t** ref = vector_get(&proc->parser->items, i);
+		if (!((*ref)->contains & contains_defer)) continue;
+
+		proc->iter.end = i+1;
+
+		vector_clear(&proc->iter.stack);
+		proc->iter.x_ref = ref-1;
+		tag_items(proc);
+
+		vector_clear(&proc->iter.stack);
+		proc->iter.x_ref = ref-1;
+		process(proc);
+	}
+
+	proc->iter.end = -1;
+}
+
+process_t process_init(parser_t* parser, process_opts_t opts) {
+	return (process_t){.syms=symtab_new(), .parser=parser, .opts=opts,
+			.iter=item_iterate(parser), .objs=vector_new(sizeof(void*)),
+			.walk=vector_new(sizeof(item_t*)), .splices=vector_new(sizeof(splice_t)),
+			.counters=vector_new(sizeof(exit_counter_t)), .bloat=vector_new(sizeof(bloat_t))};
+}
+
+void process_free(process_t* proc) {
+	symtab_free(&proc->syms);
+
+	vector_iterator obj_iter = vector_iterate(&proc->objs);
+	while (vector_next(&obj_iter)) {
+		drop(*(void**)obj_iter.x);
+	}
+
+	vector_free(&proc->objs);
+	vector_free(&proc->walk);
+	vector_free(&proc->splices);
+	vector_free(&proc->counters);
+	vector_free(&proc->bloat);
 
 	item_iterator_free(&proc->iter);
 }
+
+//a function with defers, processed by whichever worker gets to it first
+typedef struct {
+	unsigned item_i;
+
+	//kept apart until every job is done, then merged in order
+	vector_t errors;
+	vector_t gen_pool;
+	vector_t counters;
+	vector_t bloat;
+	int stop;
+} process_job_t;
+
+typedef struct {
+	process_t* proc;
+	vector_t jobs;
+	atomic_uint next;
+} process_jobs_t;
+
+typedef struct {
+	process_jobs_t* jobs;
+	parser_t parser; //shallow copy, only errors and gen_pool are written to
+	process_t proc;
+} process_worker_t;
+
+void* process_worker(void* arg) {
+	process_worker_t* worker = arg;
+	parser_t* parser = &worker->parser;
+
+	while (1) {
+		process_job_t* job = vector_get(&worker->jobs->jobs, atomic_fetch_add(&worker->jobs->next, 1));
+		if (!job) return NULL;
+
+		parser->errors = vector_new(sizeof(parser_error_t));
+		parser->gen_pool = vector_new(sizeof(item_t*));
+		parser->stop = 0;
+
+		process_items(&worker->proc, job->item_i, job->item_i+1);
+
+		job->errors = parser->errors;
+		job->gen_pool = parser->gen_pool;
+		job->counters = worker->proc.counters;
+		worker->proc.counters = vector_new(sizeof(exit_counter_t));
+		job->bloat = worker->proc.bloat;
+		worker->proc.bloat = vector_new(sizeof(bloat_t));
+		job->stop = parser->stop;
+	}
+}
+
+//functions are independent, so each is a job for a pool of workers with their own process_t
+//results are merged in source order, and errors after the first fatal one are dropped as if processing stopped there
+void process_parallel(process_t* proc) {
+	parser_t* parser = proc->parser;
+	process_jobs_t jobs = {.proc=proc, .jobs=vector_new(sizeof(process_job_t))};
+	atomic_init(&jobs.next, 0);
+
+	vector_iterator item_iter = vector_iterate(&parser->items);
+	while (vector_next(&item_iter)) {
+		if ((*(item_t**)item_iter.x)->contains & contains_defer)
+			vector_pushcpy(&jobs.jobs, &(process_job_t){.item_i=item_iter.i});
+	}
+
+	unsigned threads = proc->opts.threads;
+	if (threads>jobs.jobs.length) threads=jobs.jobs.length;
+
+	if (threads<2) {
+		vector_free(&jobs.jobs);
+		process_items(proc, 0, parser->items.length);
+		return;
+	}
+
+	process_worker_t* workers = heap(sizeof(process_worker_t)*threads);
+	pthread_t* threads_t = heap(sizeof(pthread_t)*threads);
+	for (unsigned i=0; i<threads; i++) {
+		workers[i].jobs = &jobs;
+		workers[i].parser = *parser;
+		workers[i].proc = process_init(&workers[i].parser, proc->opts);
+
+		pthread_create(&threads_t[i], NULL, process_worker, &workers[i]);
+	}
+
+	for (unsigned i=0; i<threads; i++) pthread_join(threads_t[i], NULL);
+
+	vector_iterator job_iter = vector_iterate(&jobs.jobs);
+	while (vector_next(&job_iter)) {
+		process_job_t* job = job_iter.x;
+
+		if (!parser->stop) {
+			vector_iterator err_iter = vector_iterate(&job->errors);
+			while (vector_next(&err_iter)) vector_pushcpy(&parser->errors, err_iter.x);
+			if (job->stop) parser->stop=1;
+		}
+
+		vector_iterator gen_iter = vector_iterate(&job->gen_pool);
+		while (vector_next(&gen_iter)) vector_pushcpy(&parser->gen_pool, gen_iter.x);
+
+		vector_iterator counter_iter = vector_iterate(&job->counters);
+		while (vector_next(&counter_iter)) vector_pushcpy(&proc->counters, counter_iter.x);
+
+		vector_iterator bloat_iter = vector_iterate(&job->bloat);
+		while (vector_next(&bloat_iter)) vector_pushcpy(&proc->bloat, bloat_iter.x);
+
+		vector_free(&job->errors);
+		vector_free(&job->gen_pool);
+		vector_free(&job->counters);
+		vector_free(&job->bloat);
+	}
+
+	//scopes outlive the workers
+	for (unsigned i=0; i<threads; i++) {
+		vector_iterator obj_iter = vector_iterate(&workers[i].proc.objs);
+		while (vector_next(&obj_iter)) vector_pushcpy(&proc->objs, obj_iter.x);
+
+		vector_clear(&workers[i].proc.objs);
+		process_free(&workers[i].proc);
+	}
+
+	drop(workers);
+	drop(threads_t);
+	vector_free(&jobs.jobs);
+}
+
+//functions matching opts.instrument read the clock on entry, and defer adding the time taken to their entry in the table
+//names of the functions, by their index in the table, are added to probes
+void instrument_items(process_t* proc, vector_t* probes) {
+	vector_iterator item_iter = vector_iterate(&proc->parser->items);
+	while (vector_next(&item_iter)) {
+		item_t* func = *(item_t**)item_iter.x;
+		item_t* block = func->ty==item_func ? item_nth(func, 3) : NULL;
+		if (!block || block->ty!=item_block) continue;
+
+		char* name = item_str(proc->parser, item_nth(func, 1));
+		if (fnmatch(proc->opts.instrument, name, 0)!=0) {
+			drop(name);
+			continue;
+		}
+
+		item_t* defer = item_new(proc, item_defer, block, block);
+		item_t* epilogue = item_push(proc, item_expr, defer, block);
+		vector_pushcpy(&epilogue->body, &(item_t*){item_raw(proc, epilogue, block, heapstr("__prof_exit(%u, __prof_start)", probes->length))});
+
+		vector_insertcpy(&block->body, 0, &defer);
+		vector_insertcpy(&block->body, 0, &(item_t*){item_raw(proc, block, block, heapcpystr("unsigned long long __prof_start = __prof_now();"))});
+
+		defer->contains = contains_defer;
+		block->contains |= contains_defer;
+		func->contains |= contains_defer;
+
+		vector_pushcpy(probes, &name);
+	}
+}
+
+//probes are declared before everything else, and defined along with the table at the end
+//counts and times are dumped to stderr when the program exits
+void instrument_table(process_t* proc, vector_t* probes) {
+	vector_t* items = &proc->parser->items;
+
+	vector_insertcpy(items, 0, &(item_t*){item_raw(proc, NULL, NULL, heapcpystr(
+			"static unsigned long long __prof_now(void);\n"
+			"static void __prof_exit(unsigned fn, unsigned long long start);\n"))});
+
+	vector_t names = vector_new(1);
+	vector_iterator probe_iter = vector_iterate(probes);
+	while (vector_next(&probe_iter)) {
+		char* name = heapstr("{\"%s\"}, ", *(char**)probe_iter.x);
+		vector_stockcpy(&names, strlen(name), name);
+		drop(name);
+	}
+
+	vector_pushcpy(&names, &(char){0});
+
+	vector_pushcpy(items, &(item_t*){item_raw(proc, NULL, NULL, heapstr(
+			"\n#include <stdio.h>\n"
+			"#include <time.h>\n"
+			"static struct { const char* name; unsigned long long calls, ticks; } __prof_fns[%u] = {", probes->length))});
+	vector_pushcpy(items, &(item_t*){item_raw(proc, NULL, NULL, names.data)});
+
+	vector_pushcpy(items, &(item_t*){item_raw(proc, NULL, NULL, heapstr(
+			"};\n"
+			"static unsigned long long __prof_now(void) {\n"
+			"#if defined(__x86_64__) || defined(__i386__)\n"
+			"\treturn __builtin_ia32_rdtsc();\n"
+			"#else\n"
+			"\tstruct timespec ts;\n"
+			"\ttimespec_get(&ts, TIME_UTC);\n"
+			"\treturn ts.tv_sec*1000000000ull + ts.tv_nsec;\n"
+			"#endif\n"
+			"}\n"
+			"static void __prof_exit(unsigned fn, unsigned long long start) {\n"
+			"\t__atomic_fetch_add(&__prof_fns[fn].calls, 1, __ATOMIC_RELAXED);\n"
+			"\t__atomic_fetch_add(&__prof_fns[fn].ticks, __prof_now()-start, __ATOMIC_RELAXED);\n"
+			"}\n"
+			"__attribute__((destructor)) static void __prof_dump(void) {\n"
+			"\tfor (unsigned i=0; i<%u; i++) if (__prof_fns[i].calls)\n"
+			"\t\tfprintf(stderr, \"%%s: %%llu calls, %%llu ticks\\n\", __prof_fns[i].name, __prof_fns[i].calls, __prof_fns[i].ticks);\n"
+			"}\n", probes->length))});
+}
+
+//counters are numbered in source order, whichever worker lowered them
+//the mapping to lines is emitted at the end with a dump at exit, like the instrumentation table
+void counter_table(process_t* proc) {
+	vector_t* items = &proc->parser->items;
+	unsigned len = proc->counters.length;
+
+	vector_t sites = vector_new(1);
+	vector_iterator counter_iter = vector_iterate(&proc->counters);
+	while (vector_next(&counter_iter)) {
+		exit_counter_t* counter = counter_iter.x;
+		counter->item->str = heapstr("__atomic_fetch_add(&__exit_counts[%u], 1, __ATOMIC_RELAXED);", counter_iter.i);
+
+		char* site = heapstr("{%u, \"%s\"}, ", parser_line(proc->parser, counter->tok), counter->kind);
+		vector_stockcpy(&sites, strlen(site), site);
+		drop(site);
+	}
+
+	vector_pushcpy(&sites, &(char){0});
+
+	vector_insertcpy(items, 0, &(item_t*){item_raw(proc, NULL, NULL, heapstr(
+			"static unsigned long long __exit_counts[%u];\n", len))});
+
+	vector_pushcpy(items, &(item_t*){item_raw(proc, NULL, NULL, heapstr(
+			"\n#include <stdio.h>\n"
+			"static const struct { unsigned line; const char* kind; } __exit_sites[%u] = {", len))});
+	vector_pushcpy(items, &(item_t*){item_raw(proc, NULL, NULL, sites.data)});
+
+	vector_pushcpy(items, &(item_t*){item_raw(proc, NULL, NULL, heapstr(
+			"};\n"
+			"__attribute__((destructor)) static void __exit_counts_dump(void) {\n"
+			"\tfor (unsigned i=0; i<%u; i++)\n"
+			"\t\tfprintf(stderr, \"%%u: line %%u %%s: %%llu\\n\", i, __exit_sites[i].line, __exit_sites[i].kind, __exit_counts[i]);\n"
+			"}\n", len))});
+}
+
+//generated text in tokens, words and numbers count as one and other characters but whitespace as one each
+unsigned text_tokens(char* s) {
+	unsigned tokens=0;
+	while (*s) {
+		if (isspace(*s)) {
+			s++;
+			continue;
+		}
+
+		tokens++;
+		if (isalnum(*s) || *s=='_') {
+			while (isalnum(*s) || *s=='_') s++;
+		} else if (*s=='"') {
+			for (s++; *s && *s!='"'; s++) if (*s=='\\' && s[1]) s++;
+			if (*s) s++;
+		} else {
+			s++;
+		}
+	}
+
+	return tokens;
+}
+
+//what a generated item emits around its children
+char* gen_syntax(item_t* item) {
+	if (item->str) return item->str;
+
+	switch (item->ty) {
+		case item_label: return ":";
+		case item_goto: return "goto ;";
+		case item_ret: return "return ;";
+		case item_if: return "if ( )";
+		case item_block: return "{ }";
+		case item_fncall: return "( )";
+		default: return "";
+	}
+}
+
+unsigned item_bytes(parser_t* parser, item_t* item) {
+	if (item->span.end<item->span.start) return 0;
+
+	token_t* start = vector_get(&parser->tokens, item->span.start);
+	token_t* end = vector_get(&parser->tokens, item->span.end);
+	return start->t==end->t ? end->start+end->len-start->start : 0;
+}
+
+int bloat_ref_cmp(const void* a, const void* b) {
+	const bloat_ref_t* r1=a, *r2=b;
+	if (r1->func!=r2->func) return r1->func<r2->func ? -1 : 1;
+	if (r1->defer!=r2->defer) return r1->defer<r2->defer ? -1 : 1;
+	return r1->i<r2->i ? -1 : 1;
+}
+
+//defers by their first record, which takes them out before they are placed
+int bloat_defer_cmp(const void* a, const void* b) {
+	const bloat_ref_t* r1=*(bloat_ref_t**)a, *r2=*(bloat_ref_t**)b;
+	return r1->i<r2->i ? -1 : 1;
+}
+
+//--bloat-report: what lowering added to each function, deferred statements by their copies
+//tokens are counted like item_cost, bytes without whitespace between generated items
+void bloat_report(process_t* proc, FILE* f) {
+	parser_t* parser = proc->parser;
+	int json = proc->opts.bloat==bloat_json;
+
+	if (json) fprintf(f, "[");
+	else fprintf(f, "%-24s %6s %6s %6s %6s %8s %8s %8s %8s  %s\n", "function", "line", "copies", "labels", "gotos", "tokens", "+tokens", "bytes", "+bytes", "exits");
+
+	//ordinals of functions lowered by different workers overlap, so by parents
+	vector_t refs = vector_new(sizeof(bloat_ref_t));
+	vector_iterator bloat_iter = vector_iterate(&proc->bloat);
+	while (vector_next(&bloat_iter)) {
+		bloat_t* b = bloat_iter.x;
+
+		item_t* func = b->defer;
+		while (func->parent) func = func->parent;
+		if (func->ty!=item_func) continue;
+
+		vector_pushcpy(&refs, &(bloat_ref_t){.func=func, .defer=b->defer, .i=bloat_iter.i});
+	}
+
+	if (refs.length>0) qsort(vector_get(&refs, 0), refs.length, sizeof(bloat_ref_t), bloat_ref_cmp);
+
+	vector_t defers = vector_new(sizeof(bloat_ref_t*)); //first record of each defer of the function
+	int first_fn=1;
+
+	vector_iterator item_iter = vector_iterate(&parser->items);
+	while (vector_next(&item_iter)) {
+		item_t* func = *(item_t**)item_iter.x;
+		if (func->ty!=item_func) continue;
+
+		unsigned lo=0, hi=refs.length;
+		while (lo<hi) {
+			unsigned mid = (lo+hi)/2;
+			if (((bloat_ref_t*)vector_get(&refs, mid))->func<func) lo=mid+1;
+			else hi=mid;
+		}
+
+		vector_clear(&defers);
+
+		unsigned copies=0;
+		int tokens=0, bytes=0;
+		for (unsigned i=lo; i<refs.length; i++) {
+			bloat_ref_t* ref = vector_get(&refs, i);
+			if (ref->func!=func) break;
+
+			bloat_t* b = vector_get(&proc->bloat, ref->i);
+			if (!b->kind) {
+				vector_pushcpy(&defers, &ref);
+				tokens -= (int)item_cost(b->defer);
+				bytes -= (int)item_bytes(parser, b->defer);
+			} else if (b->copy) {
+				copies++;
+				tokens += (int)item_cost(b->deferred);
+				bytes += (int)item_bytes(parser, b->deferred);
+			}
+		}
+
+		if (defers.length==0) continue;
+		qsort(vector_get(&defers, 0), defers.length, sizeof(bloat_ref_t*), bloat_defer_cmp);
+
+		unsigned labels=0, gotos=0;
+		vector_clear(&proc->walk);
+		vector_pushcpy(&proc->walk, &func);
+
+		while (proc->walk.length>0) {
+			item_t* x = *(item_t**)vector_get(&proc->walk, proc->walk.length-1);
+			vector_pop(&proc->walk);
+
+			if (x->gen) {
+				if (x->ty==item_label) labels++;
+				else if (x->ty==item_goto) gotos++;
+
+				char* syntax = gen_syntax(x);
+				tokens += (int)text_tokens(syntax);
+				for (char* c=syntax; *c; c++) if (!isspace(*c)) bytes++;
+			}
+
+			vector_iterator body_iter = vector_iterate(&x->body);
+			while (vector_next(&body_iter)) vector_pushcpy(&proc->walk, body_iter.x);
+		}
+
+		char* name = item_str(parser, item_nth(func, 1));
+		unsigned line = parser_line(parser, func->span.start);
+
+		if (json) {
+			fprintf(f, "%s\n{\"function\": \"%s\", \"line\": %u, \"copies\": %u, \"labels\": %u, \"gotos\": %u, "
+					"\"tokens\": %u, \"tokens_added\": %d, \"bytes\": %u, \"bytes_added\": %d, \"defers\": [",
+					first_fn ? "" : ",", name, line, copies, labels, gotos, item_cost(func), tokens, item_bytes(parser, func), bytes);
+		} else {
+			fprintf(f, "%-24s %6u %6u %6u %6u %8u %+8d %8u %+8d\n", name, line, copies, labels, gotos, item_cost(func), tokens, item_bytes(parser, func), bytes);
+		}
+
+		first_fn=0;
+		drop(name);
+
+		vector_iterator defer_iter = vector_iterate(&defers);
+		while (vector_next(&defer_iter)) {
+			bloat_ref_t* first_ref = *(bloat_ref_t**)defer_iter.x;
+			bloat_t* d = vector_get(&proc->bloat, first_ref->i);
+
+			//the defer's records follow its first
+			bloat_ref_t* last = vector_get(&refs, refs.length-1);
+			bloat_ref_t* end = first_ref;
+			unsigned defer_copies=0;
+			for (; end<=last && end->defer==d->defer; end++) {
+				bloat_t* b = vector_get(&proc->bloat, end->i);
+				if (b->kind && b->copy) defer_copies++;
+			}
+
+			int defer_tokens = (int)(defer_copies*item_cost(d->deferred)) - (int)item_cost(d->defer);
+			int defer_bytes = (int)(defer_copies*item_bytes(parser, d->deferred)) - (int)item_bytes(parser, d->defer);
+			unsigned defer_line = parser_line(parser, d->defer->span.start);
+			char* ty = d->defer->ty==item_errdefer ? "errdefer" : "defer";
+
+			if (json) {
+				fprintf(f, "%s\n\t{\"%s\": %u, \"copies\": %u, \"tokens_added\": %d, \"bytes_added\": %d, \"exits\": [",
+						defer_iter.i ? "," : "", ty, defer_line, defer_copies, defer_tokens, defer_bytes);
+			} else {
+				fprintf(f, "  %-22s %6u %6u %6s %6s %8s %+8d %8s %+8d  ", ty, defer_line, defer_copies, "", "", "", defer_tokens, "", defer_bytes);
+			}
+
+			//a list of exits per copy, split on the records marked as copies
+			int first=1;
+			for (bloat_ref_t* ref=first_ref; ref<end; ref++) {
+				bloat_t* b = vector_get(&proc->bloat, ref->i);
+				if (!b->kind) continue;
+
+				unsigned exit_line = parser_line(parser, b->tok);
+				if (json) {
+					fprintf(f, "%s{\"kind\": \"%s\", \"line\": %u}", b->copy ? first ? "[" : "], [" : ", ", b->kind, exit_line);
+				} else {
+					fprintf(f, "%s%s:%u", b->copy ? first ? "" : " " : ",", b->kind, exit_line);
+				}
+
+				first=0;
+			}
+
+			if (json) fprintf(f, first ? "]}" : "]]}");
+			else fprintf(f, "\n");
+		}
+
+		if (json) fprintf(f, "]}");
+	}
+
+	if (json) fprintf(f, "\n]\n");
+	vector_free(&defers);
+	vector_free(&refs);
+}
+
+process_t process_new(parser_t* parser, process_opts_t opts) {
+	process_t proc = process_init(parser, opts);
+
+	vector_t probes = vector_new(sizeof(char*));
+	if (opts.instrument) instrument_items(&proc, &probes);
+
+	if (opts.threads>1) process_parallel(&proc);
+	else process_items(&proc, 0, parser->items.length);
+
+	if (probes.length>0 && !parser->stop) instrument_table(&proc, &probes);
+	if (proc.counters.length>0 && !parser->stop) counter_table(&proc);
+
+	vector_iterator probe_iter = vector_iterate(&probes);
+	while (vector_next(&probe_iter)) drop(*(char**)probe_iter.x);
+	vector_free(&probes);
+
+	return proc;
+}
@@ -2,6 +2,11 @@
 
 #pragma once
 #include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <fnmatch.h>
+#include <ctype.h>
 #include <util.h>
 #include "types.h"
 int item_eq(parser_t* parser, item_t* i1, item_t* i2);
@@ -11,6 +16,8 @@ typedef struct {
 	vector_t stack; //item_t** within body
 	item_t** x_ref;
 	item_t* x;
+
+	unsigned end; //top-level items past this are not iterated
 } item_iterator_t;
 item_iterator_t item_iterate(parser_t* parser);
 void item_restart(item_iterator_t* iter);
@@ -21,17 +28,61 @@ int item_next(item_iterator_t* iter);
 void item_descend(item_iterator_t* iter);
 void item_ascend(item_iterator_t* iter);
 void item_set(item_iterator_t* iter, item_t* item);
+unsigned item_index(item_iterator_t* iter);
 void item_remove(item_iterator_t* iter);
 int item_until(item_iterator_t* iter, item_ty ty);
 int item_special(item_t* item);
 item_t* item_get(item_iterator_t* iter, unsigned i);
 void item_iterator_free(item_iterator_t* iter);
+//pending change to a body, applied along with the rest of the body's in splice_apply
+typedef struct {
+	item_t* parent;
+	unsigned i; //index into the body as it was before splicing
+	item_t* item;
+
+	char replace; //replaces the item at i, otherwise inserted before it
+	char decl; //inserted before everything else at i, so that it is in scope there
+	unsigned order;
+} splice_t;
+
+//increment of an exit's counter, numbered once every function is processed
+typedef struct {
+	item_t* item;
+	unsigned tok; //line is looked up after, parser_line isnt thread safe
+	char* kind;
+} exit_counter_t;
+
+//deferred statement placed for an exit, for --bloat-report
+//a copy run by several exits is recorded for each, only the first is marked
+typedef struct {
+	item_t* defer, *deferred;
+	char copy; //first record of a copy, 0 for others and for defers only taken out
+	unsigned tok; //exit or end of scope, -1 if none
+	char* kind;
+} bloat_t;
+
+//a bloat_t with its function, sorted so each function's and then each defer's records are together
+typedef struct {
+	item_t* func, *defer;
+	unsigned i; //in proc->bloat, order within a defer
+} bloat_ref_t;
+
 typedef struct {
 	vector_t objs; //pointers to allocated objects (above)
-	vector_t names;
 
-	map_t name_label;
-	map_t name_item;
+	vector_t walk; //item_t*, scratch stack for tree walks outside of iter
+	unsigned ordinal; //last pre-order number handed out by tag_items
+	vector_t splices; //splice_t, for the scope being lowered
+	vector_t counters; //exit_counter_t, with --count-exits
+	vector_t bloat; //bloat_t, with --bloat-report
+	unsigned fn_defers; //defers seen in the current function, for generated names
+	unsigned fn_colds; //cold exit labels in the current function, numbered for the same
+	unsigned fn_ladders; //ladder labels in the current function, likewise
+	char fn_ret; //some return in the current function goes through its return slot
+
+	process_opts_t opts;
+
+	symtab_t syms; //labels of the current function
 
 	item_iterator_t iter;
 
@@ -39,14 +90,132 @@ typedef struct {
 } process_t;
 item_t* scope_get(item_t* item);
 item_t* item_iter_scope(item_iterator_t* iter);
+symtab_t symtab_new();
+void sym_enter(symtab_t* tab);
+void sym_exit(symtab_t* tab);
+int sym_live(symtab_t* tab, sym_t* sym);
+sym_t* sym_visible(symtab_t* tab, sym_t* sym);
+sym_t* sym_probe(symtab_t* tab, char* name, unsigned hash, sym_t** reuse);
+item_t* sym_find(symtab_t* tab, char* name);
+void sym_grow(symtab_t* tab);
+sym_t* sym_insert(symtab_t* tab, char* name, item_t* item);
+void symtab_free(symtab_t* tab);
 scope_t* scope_new(process_t* proc);
-void scope_exit(process_t* proc, scope_t* scope);
-int expr_const(item_iterator_t* iter);
+void scope_labels(process_t* proc, scope_t* scope);
+//operators of constant integer expressions
+typedef enum {
+	cop_paren, //not an operator, bottom of a parenthesized group
+	cop_neg, cop_pos, cop_not, cop_compl, //unary
+	cop_mul, cop_div, cop_mod, cop_add, cop_sub, cop_shl, cop_shr,
+	cop_lt, cop_gt, cop_le, cop_ge, cop_eq, cop_ne,
+	cop_and, cop_xor, cop_or, cop_land, cop_lor,
+	cop_cond, cop_else //? and :, : pairs up both branches for ?
+} cop_ty;
+
+typedef struct {
+	long long v, other; //other is the else branch of a pair
+	char pair;
+} const_t;
+
+typedef struct {
+	item_t* item;
+	unsigned i;
+
+	char group; //pops to its cop_paren when done
+	char ternary; //children are the branches
+	char branches; //of a ternary seen so far
+
+	char operand; //an operand was seen since the last binary operator
+	char binary; //last child was a binary operator, so an expression after it is the rest of the chain
+	char rest; //right hand side of a binary operator was seen, which ends the expression
+} const_frame_t;
+int cop_parse(char* s, int unary);
+int cop_prec(cop_ty op);
+int cop_apply(vector_t* ops, vector_t* vals);
+int cop_reduce(vector_t* ops, vector_t* vals, int prec, int right);
+char* item_tok_str(parser_t* parser, item_t* item);
+int expr_const(parser_t* parser, item_t* expr, long long* out);
+item_t* item_nth(item_t* item, unsigned i);
+int cond_const(parser_t* parser, item_t* item, unsigned i);
+int item_dead(parser_t* parser, item_t* item);
+unsigned item_tok(item_t* item);
 item_t* item_new(process_t* proc, item_ty ty, item_t* inherit, item_t* parent);
 item_t* item_push(process_t* proc, item_ty ty, item_t* parent, item_t* inherit);
-int scope_exits_early(process_t* proc, item_t* origin);
+item_t* item_raw(process_t* proc, item_t* parent, item_t* inherit, char* str);
+item_t* label_new(process_t* proc, item_t* parent, char* prefix);
+item_t* goto_new(process_t* proc, item_t* label, item_t* inherit);
+void item_attribute(item_t* item, unsigned tok);
+unsigned item_cost(item_t* item);
+void splice(process_t* proc, item_t* parent, unsigned i, item_t* item, int replace);
+void splice_decl(process_t* proc, item_t* parent, unsigned i, item_t* item);
+int splice_cmp(const void* a, const void* b);
+void splice_apply(process_t* proc);
+void item_replace(process_t* proc, item_t* item, unsigned i, vector_t* items);
+item_t* loop_scope(item_t* loop, item_t* current);
+int loop_body(item_t* scope_item);
+item_t* exit_stop(exit_t* ex);
+void exit_cleanups(exit_t* ex, item_t* from, unsigned from_i, vector_t* out);
+int ret_ptr(item_t* func);
+int ret_err(parser_t* parser, item_t* func, item_t* ret);
+int exit_errdefers(exit_t* ex, item_t* from, unsigned from_i);
+char* ret_slot_ty(parser_t* parser, item_t* func);
+void ret_slot(process_t* proc, exit_t* ex);
+item_t* exit_branch(exit_t* ex);
+void branch_unlikely(process_t* proc, item_t* branch);
+void ret_slot_decl(process_t* proc);
+int item_breaks(item_t* loop);
+int item_falls_through(process_t* proc, item_t* item);
+item_t* exit_counter(process_t* proc, item_t* parent, item_t* inherit, unsigned tok, char* kind);
+char* exit_kind(exit_t* ex);
+unsigned exit_tok(exit_t* ex);
+void exit_count(process_t* proc, exit_t* ex, vector_t* items);
+item_t* item_defer_of(item_t* item);
+void bloat_place(process_t* proc, item_t* deferred, char copy, unsigned tok, char* kind);
+void bloat_exit(process_t* proc, vector_t* items, exit_t* ex, int kind);
+void bloat_ladder(process_t* proc, item_t* deferred, unsigned deferred_i, int falls);
+void scope_lower_dup(process_t* proc, int falls);
+void scope_lower_ladder(process_t* proc, vector_t* kinds, int falls);
+void scope_lower_continues(process_t* proc);
+void scope_lower_latch(process_t* proc, int more);
+void defer_cleanup(process_t* proc);
 void tag_items(process_t* proc);
 void process_scope(process_t* proc);
 void process(process_t* proc);
-process_t process_new(parser_t* parser);
+void process_items(process_t* proc, unsigned from, unsigned to);
+process_t process_init(parser_t* parser, process_opts_t opts);
 void process_free(process_t* proc);
+//a function with defers, processed by whichever worker gets to it first
+typedef struct {
+	unsigned item_i;
+
+	//kept apart until every job is done, then merged in order
+	vector_t errors;
+	vector_t gen_pool;
+	vector_t counters;
+	vector_t bloat;
+	int stop;
+} process_job_t;
+
+typedef struct {
+	process_t* proc;
+	vector_t jobs;
+	atomic_uint next;
+} process_jobs_t;
+
+typedef struct {
+	process_jobs_t* jobs;
+	parser_t parser; //shallow copy, only errors and gen_pool are written to
+	process_t proc;
+} process_worker_t;
+void* process_worker(void* arg);
+void process_parallel(process_t* proc);
+void instrument_items(process_t* proc, vector_t* probes);
+void instrument_table(process_t* proc, vector_t* probes);
+void counter_table(process_t* proc);
+unsigned text_tokens(char* s);
+char* gen_syntax(item_t* item);
+unsigned item_bytes(parser_t* parser, item_t* item);
+int bloat_ref_cmp(const void* a, const void* b);
+int bloat_defer_cmp(const void* a, const void* b);
+void bloat_report(process_t* proc, FILE* f);
+process_t process_new(parser_t* parser, process_opts_t opts);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <ctype.h>
+#include <stdatomic.h>
 
 #include "util.h"
 #include "vector.h"
@@ -17,8 +18,8 @@ typedef enum {
 	//types
 	tok_typedef, tok_enum, tok_struct, tok_union, tok_static, tok_inline, tok_const,
 	//flow
-	tok_if, tok_else, tok_elseif, tok_do, tok_while, tok_for, tok_defer, tok_return,
-	tok_switch, tok_break, tok_case, tok_default, tok_goto,
+	tok_if, tok_else, tok_elseif, tok_do, tok_while, tok_for, tok_defer, tok_errdefer, tok_return,
+	tok_switch, tok_break, tok_continue, tok_case, tok_default, tok_goto,
 	//we dont do any complex static analysis and compile to C, pass all other valid tokens (eg. comparisons) through here
 	tok_other,
 	//any assignment operation goes through here
@@ -33,8 +34,8 @@ static char* TOKEN_NAMES[tok_eof+1] = {
 	"access", "name", "builtin", "str", "char", "num",
 	"include", "define", "ifdir", "ifdef", "elifdir", "elsedir", "endif", "dir",
 	"typedef", "enum", "struct", "union", "static", "inline", "const",
-	"if", "else", "elseif", "do", "while", "for", "defer", "return",
-	"switch", "case", "default", "goto",
+	"if", "else", "elseif", "do", "while", "for", "defer", "errdefer", "return",
+	"switch", "break", "continue", "case", "default", "goto",
 	"other",
 	"set",
 	"unary set",
@@ -54,6 +55,7 @@ typedef struct {
 typedef enum {
 	item_expr,
 	item_defer,
+	item_errdefer,
 	item_ret,
 	item_op,
 	item_ternary,
@@ -79,6 +81,7 @@ typedef enum {
 	item_switch,
 	item_case,
 	item_break,
+	item_continue,
 	item_typedef,
 	item_enum,
 	item_enumi,
@@ -112,12 +115,12 @@ typedef enum {
 } item_ty;
 
 static char* ITEM_NAMES[item_length] = {
-	"item_expr", "item_defer", "item_ret", "item_op", "item_ternary", "item_dot", "item_access",
+	"item_expr", "item_defer", "item_errdefer", "item_ret", "item_op", "item_ternary", "item_dot", "item_access",
 	"item_litstr", "item_litchar", "item_litnum", "item_initializer",
 	"item_cast", "item_initvar", "item_initi", "item_func", "item_var", "item_varset",
 	"item_assignment", "item_while", "item_dowhile", "item_for",
 	"item_if", "item_elseif", "item_else", "item_switch", "item_case", "item_break",
-	"item_typedef", "item_enum", "item_enumi", "item_struct", "item_union", "item_field",
+	"item_continue", "item_typedef", "item_enum", "item_enumi", "item_struct", "item_union", "item_field",
 	"item_type", "item_typemod", "item_define", "item_include",
 	"item_arg", "item_args", "item_name", "item_uber", "item_array", "item_fnptr",
 	"item_fncall", "item_body", "item_block", "item_ifdir", "item_ifdef",
@@ -131,43 +134,115 @@ typedef struct {
 
 struct item;
 
-//break/return/goto
+//break/continue/return/goto
 typedef struct {
 	unsigned defer_i;
 	struct item* item;
 	struct item* exit_scope;
+
+	unsigned body_i; //index of item in its parent's body when the exit was found
+	unsigned kind; //exits with equal items, stops and err share a kind, from 1
+	char err; //1 on error exits, which errdefers only run on, -1 if that cant be told
+	struct item* value; //stores the returned value in the return slot, before cleanups
 } exit_t;
 
+//scoped symbol, open addressed by name
+//entries are never removed, they only count while the scope they were declared in is open
+typedef struct {
+	char* name; //owned, NULL if the slot is empty
+	unsigned hash;
+	struct item* item;
+
+	unsigned depth, stamp; //of the declaring scope
+	unsigned shadowed; //index+1 into symtab_t.shadowed of the entry this one hides
+} sym_t;
+
+typedef struct {
+	sym_t* slots;
+	unsigned cap, len; //len counts occupied slots, stale or not
+
+	vector_t shadowed; //sym_t, hidden entries of open scopes
+	vector_t open; //stamps of open scopes, outermost first
+	unsigned stamp; //last handed out
+} symtab_t;
+
 typedef struct scope {
-	unsigned name_i;
 	vector_t deferred;
+	vector_t deferred_err; //char for each deferred, set if it is an errdefer
 	vector_t exits;
 
 	char ret; //function scope, handles returns
-	char br; //loop/switch, breaks in (sub)scopes go here
+
+	vector_t continues; //exit_t, lowered apart from other exits
+	vector_t latches; //item_t* labels in the cleanups at the end of a loop body, by number of deferred run
+
+	vector_t labels; //item_t*, function scopes only
 } scope_t;
 
+//how deferred statements are placed before exits
+typedef enum {
+	lower_auto, //whichever of the below is cheaper per scope
+	lower_dup, //copied before every exit
+	lower_ladder, //once per scope, exits jump into a chain of labels and dispatch on __defer_exit
+	lower_cleanup //gcc only, each defer is a nested function called by __attribute__((cleanup))
+} lower_ty;
+
+//--bloat-report output
+typedef enum {
+	bloat_none,
+	bloat_table,
+	bloat_json
+} bloat_ty;
+
+typedef struct {
+	lower_ty lower;
+	unsigned jump_cost; //in tokens, an exit jumping into a ladder
+	unsigned threads; //functions are processed concurrently if >1
+	char cold; //branches to early returns and gotos are unlikely, their cleanups cold
+	char* instrument; //functions whose names match this fnmatch pattern are timed, NULL for none
+	char count_exits; //lowered exits and ends of scopes bump their own counter, dumped with their lines
+	bloat_ty bloat; //code added by lowering is reported per function and defer
+} process_opts_t;
+
+#define PROCESS_OPTS_DEFAULT ((process_opts_t){.lower=lower_auto, .jump_cost=8, .threads=1})
+
 typedef struct {
 	char* define_str;
 	vector_t args;
+
+	//keys into the defining source, so other parsers can expand it
+	map_sized_t name;
+	vector_t arg_names;
 } macro_t;
 
 typedef struct {
 	char* arg_str;
 } arg_t;
 
+//what a subtree holds, so processing can skip the rest
+typedef enum {
+	contains_defer=0x1,
+	contains_exit=0x2, //return, break, continue or goto
+	contains_label=0x4
+} contains_ty;
+
 typedef struct item {
 	item_ty ty;
+	char contains; //contains_ty of itself and descendants, set by parser_wrap
+	unsigned hash; //of structure and leaf text, set by parser_wrap; 0 for generated items
 
 	vector_t body; //body of items, if ty permits
 	unsigned if_stack, if_i;
 
 	char gen;
+	char mark; //returns: 1 if marked an error exit by return errdefer, -1 a success by return defer
 	union {
 		span_t span;
 		char* str;
 	};
 
+	unsigned gen_tok; //generated items: token of the item they stand in for, whose line they are attributed to; -1 if none
+
 	union {
 		scope_t* scope;
 		macro_t* macro;
@@ -175,6 +250,10 @@ typedef struct item {
 	};
 
 	struct item* parent;
+
+	//set by tag_items; descendants are numbered (pre, post], generated items are left at 0
+	unsigned pre, post;
+	struct item* scope_parent; //nearest enclosing block
 } item_t;
 
 typedef struct {
@@ -209,6 +288,26 @@ typedef struct {
 	char* t;
 } parser_expansion_t;
 
+//zero for no limit
+typedef struct {
+	unsigned depth; //nesting of saves, ie. parentheses/blocks/operator chains
+	unsigned tokens, backtracks, expansions;
+	double time; //seconds
+} parser_limits_t;
+
+#define PARSER_LIMITS_DEFAULT ((parser_limits_t){.depth=2048, .expansions=256})
+
+//top-level boundary, parsing can resume here after an edit
+typedef struct {
+	unsigned tok_i, item_i, item_pool_i, errors_i, ifs_i, expansions_i;
+	unsigned src_i; //end of previous token in source
+} parser_decl_t;
+
+//counts of the chunk parsers of a file with -jN, so limits are of the whole file
+typedef struct {
+	atomic_uint tokens, backtracks;
+} parser_shared_t;
+
 typedef struct {
 	char* t; //t is overwritten during expansions, tokens reference that string instead
 	unsigned i, len;
@@ -228,8 +327,10 @@ typedef struct {
 	unsigned expansions_i;
 	vector_t expansion_stack; //indices to expansions
 	vector_t expansion_save;
+	vector_t arg_strs; //char*, expanded macro arguments, tokens reference these until the parser is freed
 
 	vector_t item_pool; //stores refs to every item for free later
+	vector_t gen_pool; //same for generated items, kept apart so parsed items can be truncated
 
 	vector_t tokens; //all tokens
 	vector_t items;
@@ -240,8 +341,22 @@ typedef struct {
 	vector_cap_t stack; //parse_save_t
 	vector_t errors;
 	int stop;
+	unsigned recovered; //errors before this have been recovered from
+
+	parser_limits_t limits;
+	unsigned backtracks;
+	parser_shared_t* shared; //set for chunk parsers, counted against limits instead
+	double start_time;
+	int exhausted; //a limit was hit, everything after is eof
 
 	int in_define;
 	int in_include;
 	int parsed_if; //set after branching to allow syntatic exceptions
+
+	int passthrough; //no defers in source, not parsed
+
+	vector_t decls; //parser_decl_t
+	unsigned source_cap; //nonzero when source is owned (after an edit)
+
+	vector_t line_starts; //offsets in source that lines start at, built by parser_line
 } parser_t;
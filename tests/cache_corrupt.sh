@@ -0,0 +1,25 @@
+#!/bin/sh
+# usage: cache_corrupt.sh cplus2 file.c [options]
+# corrupts every entry cached for file.c, which must then be misses lowered as before
+cplus2=$1; src=$2; shift 2
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cp "$src" "$dir/test.c"
+cd "$dir"
+
+"$cplus2" test.c --cache=cache "$@" >/dev/null || exit 1
+cp testout.c expected.c
+
+# the offset of the last line directive, then the number of them in the header
+for seek in last 24; do
+	for entry in cache/*; do
+		size=$(wc -c <"$entry")
+		[ $seek = last ] && at=$((size-12)) || at=$seek
+		printf '\377\377\377\177' | dd of="$entry" bs=1 seek=$at conv=notrunc 2>/dev/null
+	done
+
+	"$cplus2" test.c --cache=cache "$@" >/dev/null || exit 1
+	cmp -s expected.c testout.c || exit 1
+done
@@ -0,0 +1,17 @@
+#define ZERO 0
+#define ONE 1
+
+int runs;
+
+//conditions and values expanded from macros are read from the expansion
+int f(int x) {
+	defer runs++;
+	if (ZERO) return 2;
+	if (x) return ONE;
+	return ZERO;
+}
+
+int main() {
+	if (f(0)!=0 || f(1)!=1 || runs!=2) return 1;
+	return 0;
+}
@@ -0,0 +1,17 @@
+int runs;
+
+//a constant false branch is still reached through a label in it
+int f(int x) {
+	defer runs++;
+	if (x) goto fail;
+	if (0) {
+	fail:
+		return 1;
+	}
+	return 0;
+}
+
+int main() {
+	if (f(1)!=1 || f(0)!=0 || runs!=2) return 1;
+	return 0;
+}
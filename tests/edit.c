@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+int opened;
+
+int first(int x) {
+	defer opened--;
+	opened++;
+	if (x>1) return 2;
+	return 0;
+}
+
+int second(int x) {
+	char* buf = malloc(16);
+	defer free(buf);
+	if (!buf) return -1;
+	if (x) return x;
+	return 1;
+}
+
+int third(int x) {
+	defer printf("third\n");
+	return x*2;
+}
+
+int main() {
+	return first(1)+second(0)+third(0)-1;
+}
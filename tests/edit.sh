@@ -0,0 +1,19 @@
+#!/bin/sh
+# usage: edit.sh cplus2 file.c old new [options]
+# replaces the first old in file.c with new, through --edit and in a copy lowered from scratch
+# both must come out the same
+cplus2=$1; src=$2; old=$3; new=$4; shift 4
+
+offset=$(grep -boF -- "$old" "$src" | head -n 1 | cut -d: -f1)
+[ -n "$offset" ] || { echo "$old not found in $src"; exit 1; }
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+mkdir "$dir/full" "$dir/edit"
+
+cp "$src" "$dir/edit/test.c"
+{ head -c "$offset" "$src"; printf '%s' "$new"; tail -c +$((offset+${#old}+1)) "$src"; } > "$dir/full/test.c"
+
+(cd "$dir/full" && "$cplus2" test.c "$@" >/dev/null) || exit 1
+(cd "$dir/edit" && "$cplus2" test.c "--edit=$offset,${#old},$new" "$@" >/dev/null) || exit 1
+cmp "$dir/full/testout.c" "$dir/edit/testout.c"
@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <errno.h>
+
+int freed;
+
+void release(char* buf) {
+	freed++;
+	free(buf);
+}
+
+//NULL is the error of functions returning pointers, any other value their result
+char* make(int fail) {
+	char* buf = malloc(16);
+	errdefer release(buf);
+
+	if (fail) return NULL;
+	return buf;
+}
+
+int fill(int fail) {
+	char* buf = malloc(16);
+	errdefer release(buf);
+
+	if (fail) return -EINVAL;
+	free(buf);
+	return 0;
+}
+
+//return errdefer and return defer say what an exit is when its value cant
+int check(int r) {
+	char* buf = malloc(16);
+	errdefer release(buf);
+
+	if (r) return errdefer r;
+	free(buf);
+	return defer r;
+}
+
+#define ONE 1
+
+//returns of functions without errdefers are never looked into
+int plain(int x) {
+	if (x) return ONE;
+	return x;
+}
+
+int main() {
+	char* buf = make(0);
+	if (!buf || freed!=0) return 1;
+	free(buf);
+
+	if (make(1) || freed!=1) return 2;
+
+	freed=0;
+	if (fill(0)!=0 || freed!=0) return 3;
+	if (fill(1)!=-EINVAL || freed!=1) return 4;
+
+	freed=0;
+	if (check(0)!=0 || freed!=0) return 5;
+	if (check(3)!=3 || freed!=1) return 6;
+
+	if (plain(1)!=1) return 7;
+
+	return 0;
+}
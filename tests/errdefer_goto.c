@@ -0,0 +1,19 @@
+#include <stdlib.h>
+
+int fill(int fail) {
+	int ret = 0;
+	{
+		char* buf = malloc(16);
+		errdefer free(buf);
+
+		if (fail) goto out;
+		free(buf);
+	}
+
+out:
+	return ret;
+}
+
+int main() {
+	return fill(0);
+}
@@ -0,0 +1,32 @@
+#include <stdlib.h>
+
+int freed;
+
+void release(char* buf) {
+	freed++;
+	free(buf);
+}
+
+//both returns go through the return slot, only the error one runs the outer errdefer
+int get(int fail, char** out) {
+	char* buf = malloc(16);
+	errdefer release(buf);
+
+	{
+		defer freed += 10;
+		if (fail) return -1;
+		*out = buf;
+		return 0;
+	}
+}
+
+int main() {
+	char* buf;
+	if (get(0, &buf)!=0 || freed!=10) return 1;
+	free(buf);
+
+	freed=0;
+	if (get(1, &buf)!=-1 || freed!=11) return 2;
+
+	return 0;
+}
@@ -0,0 +1,18 @@
+int main() {
+	int n=4, sum=0, runs=0;
+
+	for (int i=0; i<n; i++) {
+		defer runs++;
+		if (i==1) continue;
+		if (i==3) break;
+		sum += i;
+	}
+
+	int j;
+	for (j=0; j<n; j++) {
+		defer runs++;
+	}
+
+	if (sum!=2 || runs!=8) return 1;
+	return 0;
+}
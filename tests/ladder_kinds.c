@@ -0,0 +1,17 @@
+#include <stddef.h>
+
+int runs;
+
+//without errdefers NULL and other results return the same way, so the ladder ends in one return
+char* f(int x, char* p) {
+	defer runs++;
+	if (x==1) return NULL;
+	if (x==2) return p;
+	return p;
+}
+
+int main() {
+	char c;
+	if (f(1, &c) || f(2, &c)!=&c || f(0, &c)!=&c || runs!=3) return 1;
+	return 0;
+}
@@ -0,0 +1,23 @@
+int runs;
+
+//exits ending a body fall into its ladder instead of jumping to it
+int f(int x) {
+	defer runs++;
+	{
+		if (x) return 1;
+		runs--;
+	}
+	switch (x) {
+		case 0: {
+			defer runs+=2;
+			break;
+		}
+	}
+	return 0;
+}
+
+int main() {
+	if (f(0)!=0 || runs!=2) return 1;
+	if (f(1)!=1 || runs!=3) return 1;
+	return 0;
+}
@@ -0,0 +1,10 @@
+#include <stdio.h>
+
+#define MSG "hello"
+#define TWO(a, b) printf("%s %s\n", a, b)
+
+//leaves left by a syntax error can span from the source into an expansion
+int main() {
+	defer TWO(MSG, MSG);
+	return 0;
+}
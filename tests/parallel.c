@@ -0,0 +1,67 @@
+#include <stdlib.h>
+
+#define LIMIT 2
+
+int opened;
+
+//only declarations after the last directive are parsed in parallel
+//everything before it, directives in between included, is parsed sequentially
+char* a(int x) {
+	char* p = malloc(1);
+	defer free(p);
+	if (x) return NULL;
+	opened++;
+	return NULL;
+}
+
+#define TWICE 2
+
+int b(int x) {
+	defer opened--;
+	if (x) return TWICE*x;
+	return 0;
+}
+
+#if 1
+int c(int x) {
+	defer opened++;
+	return x;
+}
+#endif
+
+int d(int x) {
+	defer opened--;
+	if (x>LIMIT) return TWICE*x;
+	return c(x);
+}
+
+int e(int x) {
+	char* p = malloc(1);
+	defer free(p);
+	while (x--) {
+		defer opened++;
+		if (x==2) break;
+	}
+	return b(x);
+}
+
+int f(int x) {
+	defer opened--;
+	switch (x) {
+		case 0: return d(x);
+		default: return e(x);
+	}
+}
+
+int g(int x) {
+	defer opened++;
+	{
+		defer opened--;
+		if (x) return f(x);
+	}
+	return a(x)!=NULL;
+}
+
+int main() {
+	return g(0)!=0 || g(3)!=4;
+}
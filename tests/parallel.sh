@@ -0,0 +1,15 @@
+#!/bin/sh
+# usage: parallel.sh cplus2 file.c [options]
+# lowers file.c sequentially and with -j4, both must come out the same
+cplus2=$1; src=$2; shift 2
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+mkdir "$dir/seq" "$dir/par"
+
+cp "$src" "$dir/seq/test.c"
+cp "$src" "$dir/par/test.c"
+
+(cd "$dir/seq" && "$cplus2" test.c "$@" >/dev/null) || exit 1
+(cd "$dir/par" && "$cplus2" test.c -j4 "$@" >/dev/null) || exit 1
+cmp "$dir/seq/testout.c" "$dir/par/testout.c"
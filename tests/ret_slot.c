@@ -0,0 +1,18 @@
+int runs;
+
+//the only statement after the defer is the return, so its slot and the exit share an index
+int twice(int x) {
+	defer runs++;
+	return x*2;
+}
+
+int last(int* p) {
+	defer *p = 0;
+	return *p;
+}
+
+int main() {
+	int v = 5;
+	if (twice(3)!=6 || last(&v)!=5 || v!=0 || runs!=1) return 1;
+	return 0;
+}
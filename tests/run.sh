@@ -0,0 +1,12 @@
+#!/bin/sh
+# usage: run.sh cplus2 file.c [options]
+# lowers file.c, then compiles and runs it, which exits nonzero on failure
+cplus2=$1; src=$2; shift 2
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cp "$src" "$dir/test.c"
+(cd "$dir" && "$cplus2" test.c "$@" >/dev/null) || exit 1
+${CC:-cc} -o "$dir/test" "$dir/testout.c" || exit 1
+"$dir/test"
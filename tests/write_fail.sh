@@ -0,0 +1,12 @@
+#!/bin/sh
+# usage: write_fail.sh cplus2 file.c [options]
+# lowers file.c into /dev/full, which must fail
+cplus2=$1; src=$2; shift 2
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cp "$src" "$dir/test.c"
+ln -s /dev/full "$dir/testout.c"
+(cd "$dir" && "$cplus2" test.c "$@" >/dev/null) && exit 1
+exit 0